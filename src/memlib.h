@@ -1,5 +1,12 @@
+void mem_init(void);
+void mem_deinit(void);
+void mem_reset_brk(void);
 void *mem_sbrk(intptr_t incr);
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
 size_t mem_pagesize(void);
+
+/* Optional: shrink the heap by decr bytes, returning 0 on success.
+   Backends that cannot shrink the heap (memlib.o) do not define it. */
+int mem_shrink(size_t decr) __attribute__((weak));
@@ -0,0 +1,217 @@
+/*
+ * memmap.c: a memlib backend for real processes.
+ *
+ * mem_init reserves one range of address space with mmap(PROT_NONE), and
+ * the heap grows from its start: mem_sbrk makes the memory below the break
+ * readable and writable with mprotect, MEM_COMMIT_STEP bytes at a time, and
+ * mem_shrink maps the steps above the new break back as PROT_NONE, which
+ * gives them to the OS. The range never moves, so mem_heap_lo, mem_heap_hi
+ * and mem_heapsize mean what they mean for memlib.o, and memory past the
+ * break reads as zero when mem_sbrk hands it out again.
+ *
+ * The range starts at a MEM_ALIGN (2 MiB) boundary and is marked with
+ * madvise(MADV_HUGEPAGE), and the steps are whole multiples of MEM_ALIGN,
+ * so the kernel can back every committed step with transparent huge pages
+ * even where they are only enabled on request.
+ *
+ * Nothing here allocates, so it is safe to use from inside malloc during
+ * process startup.
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#include "memlib.h"
+
+/* Most address space to reserve for the heap. mem_init settles for less
+   if the process may not map that much, down to MEM_RESERVE_MIN */
+#ifndef MEM_RESERVE
+#define MEM_RESERVE         ((size_t)1 << 36)
+#endif
+#define MEM_RESERVE_MIN     ((size_t)1 << 24)
+
+/* Alignment of the range: the size of a huge page */
+#define MEM_ALIGN           ((size_t)1 << 21)
+
+/* Memory is committed in multiples of this many bytes, a multiple of
+   MEM_ALIGN */
+#ifndef MEM_COMMIT_STEP
+#define MEM_COMMIT_STEP     MEM_ALIGN
+#endif
+
+/* Set to 0 to leave the range to the system default for huge pages */
+#ifndef MEM_HUGEPAGE
+#define MEM_HUGEPAGE        1
+#endif
+
+static char *mem_start_brk;     /* first byte of the heap */
+static char *mem_brk;           /* last byte of the heap plus one */
+static char *mem_commit;        /* memory below this is read/write */
+static char *mem_max_addr;      /* end of the reserved range */
+static size_t page_size;
+
+/**********************************************************
+ * page_up
+ * p rounded up to a page boundary
+ **********************************************************/
+static char *page_up(char *p)
+{
+    return (char *)(((uintptr_t)p + page_size - 1) & ~(uintptr_t)(page_size - 1));
+}
+
+/**********************************************************
+ * step_up
+ * p rounded up to a MEM_COMMIT_STEP boundary of the range
+ **********************************************************/
+static char *step_up(char *p)
+{
+    size_t off = p - mem_start_brk + MEM_COMMIT_STEP - 1;
+    return mem_start_brk + off - off % MEM_COMMIT_STEP;
+}
+
+/**********************************************************
+ * decommit
+ * Give the memory from p up to mem_commit back to the OS
+ * and make it inaccessible again
+ **********************************************************/
+static void decommit(char *p)
+{
+    if (p < mem_commit) {
+        mmap(p, mem_commit - p, PROT_NONE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+        mem_commit = p;
+    }
+}
+
+/**********************************************************
+ * mem_init
+ * Reserve the range of the heap, aligned to MEM_ALIGN. The
+ * heap is empty, and stays so if no range could be reserved
+ **********************************************************/
+void mem_init(void)
+{
+    size_t len = MEM_RESERVE;
+    char *p, *start;
+
+    page_size = (size_t)getpagesize();
+    /* Reserve MEM_ALIGN more, then unmap the unaligned ends */
+    while ((p = mmap(NULL, len + MEM_ALIGN, PROT_NONE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0)) == MAP_FAILED &&
+           len > MEM_RESERVE_MIN)
+        len /= 2;
+    if (p == MAP_FAILED) {
+        static const char msg[] = "mem_init: could not reserve the heap\n";
+        write(STDERR_FILENO, msg, sizeof(msg) - 1);
+        return;
+    }
+    start = (char *)(((uintptr_t)p + MEM_ALIGN - 1) & ~(uintptr_t)(MEM_ALIGN - 1));
+    if (start != p)
+        munmap(p, start - p);
+    munmap(start + len, p + MEM_ALIGN - start);
+#if MEM_HUGEPAGE && defined(MADV_HUGEPAGE)
+    madvise(start, len, MADV_HUGEPAGE);
+#endif
+    mem_start_brk = mem_brk = mem_commit = start;
+    mem_max_addr = start + len;
+}
+
+/**********************************************************
+ * mem_deinit
+ * Unmap the whole range
+ **********************************************************/
+void mem_deinit(void)
+{
+    if (mem_start_brk != NULL)
+        munmap(mem_start_brk, mem_max_addr - mem_start_brk);
+    mem_start_brk = mem_brk = mem_commit = mem_max_addr = NULL;
+}
+
+/**********************************************************
+ * mem_reset_brk
+ * Empty the heap and give its pages back to the OS
+ **********************************************************/
+void mem_reset_brk(void)
+{
+    decommit(mem_start_brk);
+    mem_brk = mem_start_brk;
+}
+
+/**********************************************************
+ * mem_sbrk
+ * Grow the heap by incr bytes and return the start of the
+ * new area, or (void *)-1 with errno set to ENOMEM
+ **********************************************************/
+void *mem_sbrk(intptr_t incr)
+{
+    char *old_brk = mem_brk;
+
+    if (incr < 0 || (size_t)incr > (size_t)(mem_max_addr - mem_brk)) {
+        errno = ENOMEM;
+        return (void *)-1;
+    }
+    if (mem_brk + incr > mem_commit) {
+        char *commit = step_up(mem_brk + incr);
+        if (commit > mem_max_addr)
+            commit = mem_max_addr;
+        if (mprotect(mem_commit, commit - mem_commit, PROT_READ | PROT_WRITE) != 0) {
+            errno = ENOMEM;
+            return (void *)-1;
+        }
+        mem_commit = commit;
+    }
+    mem_brk += incr;
+    return (void *)old_brk;
+}
+
+/**********************************************************
+ * mem_shrink
+ * Move the break down by decr bytes. The part of a page
+ * left above the break is cleared, the other pages of its
+ * step are dropped, and the steps above go back to the OS.
+ * Returns 0 on success
+ **********************************************************/
+int mem_shrink(size_t decr)
+{
+    char *old_brk = mem_brk;
+    char *page, *step;
+
+    if (decr > (size_t)(mem_brk - mem_start_brk))
+        return -1;
+    mem_brk -= decr;
+    page = page_up(mem_brk);
+    step = step_up(mem_brk);
+    if (page >= old_brk) {
+        memset(mem_brk, 0, decr);
+        return 0;
+    }
+    memset(mem_brk, 0, page - mem_brk);
+    if (page < step)
+        madvise(page, (step < old_brk ? step : page_up(old_brk)) - page, MADV_DONTNEED);
+    decommit(step);
+    return 0;
+}
+
+void *mem_heap_lo(void)
+{
+    return (void *)mem_start_brk;
+}
+
+void *mem_heap_hi(void)
+{
+    return (void *)(mem_brk - 1);
+}
+
+size_t mem_heapsize(void)
+{
+    return (size_t)(mem_brk - mem_start_brk);
+}
+
+size_t mem_pagesize(void)
+{
+    return page_size;
+}
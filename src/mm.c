@@ -1,26 +1,83 @@
 /*
  * This implementation of malloc uses segregated explicit linked-lists.
  * The head of each linked list is maintained at the top of head.
- * The structure of an allocated block is shown below. A free block is similar.
+ * The structure of a free block is shown below. An allocated block is the
+ * same without the footer; its payload runs up to the next header instead.
  * -------------------------------------------------------------------
  * | header || prev_ptr | next_ptr ||...payload...| padding || footer |
  * -------------------------------------------------------------------
  *  HDRP(p)    p-DSIZE    p-WSIZE    p                        FTRP(p)
+ * Besides the allocated bit, every header carries a PREV_ALLOC bit that
+ * tells whether the previous block is allocated, so only coalescing with a
+ * free previous block ever reads a footer.
  *
  * Malloc attempts to find a fit in O(1). This is done by checking a constant
  * number of blocks in the same size linked-list, and then checking in larger
- * sized linked-list for a quick fit (rather than the best fit).
- * Free does immediate coalescing, and adds the node to the appropriate list.
- * Realloc is implemented directly using mm_malloc and mm_free.
+ * sized linked-list for a quick fit (rather than the best fit). That is the
+ * default fit policy; mm_options_t.fit_policy can instead walk the lists for
+ * the first fit, the best of a bounded number of blocks, or the best fit.
+ * Free coalesces and adds the node to the appropriate list, except for
+ * blocks of up to QUICK_MAX bytes: those stay marked as allocated on a LIFO
+ * quick list of their exact size, where the next malloc of that size finds
+ * them. The quick lists are coalesced in one pass when they grow past
+ * QUICK_BYTES or when an allocation finds no fit in the segregated lists.
+ * Realloc resizes in place when a neighbouring block is free, and falls
+ * back to malloc, copy and free otherwise.
+ *
+ * Requests of up to 160 bytes are served from slabs instead: SLAB_SIZE
+ * aligned windows, each the payload of one allocated block, cut into equal
+ * slots of one kListSizes class with no per-slot header or footer. A bitmap
+ * in the slab header tracks the used slots, and slab_map tells whether the
+ * window of a pointer belongs to a slab.
+ *
+ * Requests of at least options.mmap_threshold bytes bypass the heap and get
+ * an anonymous mapping of their own, which mm_free unmaps right away and
+ * mm_realloc resizes with mremap.
+ *
+ * Free memory goes back to the OS once a free block reaches
+ * options.trim_threshold: the heap shrinks past a free block at its top when
+ * the memlib backend provides mem_shrink, and the whole pages inside any
+ * other such block are dropped with madvise(MADV_DONTNEED). mm_trim does the
+ * same for every free block on request.
+ *
+ * The segregated lists and slabs are shared by all threads and guarded by
+ * heap_lock. In front of them every CPU keeps a small cache of recently
+ * freed slots for every slab class, so mm_malloc and mm_free can serve them
+ * without taking the lock; the cache is refilled from, and flushed back to,
+ * the slabs in batches. The caches are updated in restartable sequences
+ * (rseq), which need no atomic instructions, or under a lock per CPU where
+ * the C library has not registered rseq for the threads.
+ *
+ * A free that would wait for the lock of a heap, because another thread
+ * holds heap_lock or the arena belongs to another thread, pushes the block
+ * onto a lock-free queue of the heap instead. The next allocation from the
+ * heap frees the whole queue into its lists under the lock.
+ *
+ * mm_malloc_batch cuts all its blocks out of one fit, and mm_free_batch
+ * sorts the blocks by address so that neighbours freed together merge
+ * before they are coalesced with the rest of the heap once.
+ *
+ * Arenas are heaps of their own, each in a mapping of its own with its
+ * own segregated and quick lists and its own lock; slabs, mappings and
+ * trimming are left to the main heap. Resetting an arena lays out its
+ * empty heap again, and destroying it unmaps it, both in O(1).
  *
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "mm.h"
 #include "memlib.h"
@@ -47,6 +104,7 @@ team_t team = {
 #define CHUNKSIZE   (1 << 6)      /* initial heap size (bytes) */
 
 #define MAX(x,y) ((x) > (y) ? (x) : (y))
+#define MIN(x,y) ((x) < (y) ? (x) : (y))
 
 /* Pack a size and allocated bit into a word */
 #define PACK(size, alloc) ((size) | (alloc))
@@ -61,6 +119,74 @@ team_t team = {
 #define GET_SIZE(p)     (GET(p) & ~(DSIZE - 1))
 #define GET_ALLOC(p)    (GET(p) & 0x1)
 
+/* Header bit set when the previous block is allocated */
+#define PREV_ALLOC          0x2
+#define GET_PREV_ALLOC(p)   (GET(p) & PREV_ALLOC)
+#define SET_PREV_ALLOC(p)   (GET(p) |= PREV_ALLOC)
+#define CLR_PREV_ALLOC(p)   (GET(p) &= ~(uintptr_t)PREV_ALLOC)
+
+/* Header bit set when the block is a mapping of its own; its size is
+   the length of the mapping, which starts at the page holding the byte
+   2 * DSIZE before bp (exactly there unless the block is aligned) */
+#define MMAPPED             0x4
+#define GET_MMAPPED(p)      (GET(p) & MMAPPED)
+#define MMAP_BASE(bp)       ((char *)(((uintptr_t)(bp) - 2 * DSIZE) & \
+                                      ~(uintptr_t)(mem_pagesize() - 1)))
+
+/* Default mmap_threshold. Off, because mdriver requires every payload
+   to lie inside the memlib heap */
+#ifndef MM_MMAP_THRESHOLD
+#define MM_MMAP_THRESHOLD   0
+#endif
+
+/* Default trim_threshold. Off: memlib.o cannot shrink the heap, and
+   dropping pages only makes mdriver fault them in again */
+#ifndef MM_TRIM_THRESHOLD
+#define MM_TRIM_THRESHOLD   0
+#endif
+
+/* Defaults for mm_options_t.grow_*: the heap grows by what a request
+   needs, but at least CHUNKSIZE, and by no share of its size, which keeps
+   the heap as small as mdriver measures it */
+#ifndef MM_GROW_MIN
+#define MM_GROW_MIN         CHUNKSIZE
+#endif
+#ifndef MM_GROW_PERCENT
+#define MM_GROW_PERCENT     0
+#endif
+#ifndef MM_GROW_MAX
+#define MM_GROW_MAX         (1 << 26)
+#endif
+
+/* Defaults for mm_options_t.fit_policy and fit_tries. Head-fit takes a
+   block without walking any list */
+#ifndef MM_FIT_POLICY
+#define MM_FIT_POLICY       MM_FIT_HEAD
+#endif
+#ifndef MM_FIT_TRIES
+#define MM_FIT_TRIES        8
+#endif
+
+/* Set when mem_sbrk hands out zeroed memory, as fresh anonymous pages
+   are. Off, because memlib.o recycles its heap between mdriver runs */
+#ifndef MM_SBRK_ZEROED
+#define MM_SBRK_ZEROED      0
+#endif
+
+/* mm_calloc clears at least this many bytes with non-temporal stores,
+   which bypass the cache rather than evict the working set */
+#define CALLOC_STREAM_MIN   (1 << 18)
+
+/* Blocks per list that find_aligned_fit looks at */
+#define ALIGNED_FIT_TRIES   8
+
+/* realloc only splits a shrinking block when it frees this many bytes */
+#define REALLOC_SHRINK_MIN  (1 << 7)
+
+/* Requests above this many bytes fail rather than overflow the size
+   computations */
+#define MAX_REQUEST         (SIZE_MAX / 4)
+
 /* Given block ptr bp, compute address of its header and footer */
 #define HDRP(bp)        ((char *)(bp) - WSIZE - DSIZE)
 #define FTRP(bp)        ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE - DSIZE)
@@ -69,11 +195,15 @@ team_t team = {
 #define GET_PREV(bp)    ((char *)(bp) - DSIZE)
 #define GET_NEXT(bp)    ((char *)(bp) - WSIZE)
 
-/* Given block ptr bp, compute address of next and previous blocks */
+/* Given block ptr bp, compute address of next and previous blocks.
+   PREV_BLKP reads the footer, so it is only valid if the previous block
+   is free */
 #define NEXT_BLKP(bp) ((char *)(bp) + GET_SIZE(((char *)(bp) - WSIZE - DSIZE)))
 #define PREV_BLKP(bp) ((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE - DSIZE)))
 
+#ifndef DEBUG
 #define DEBUG 0
+#endif
 
 /* Forward Declare mm_check since it was not done in header */
 int mm_check();
@@ -84,15 +214,194 @@ const int kListSizes[24] = { 16, 32, 48, 64, 96, 128, 144, 160, 256, 512,
 
 const int kLength = sizeof(kListSizes) / sizeof(kListSizes[0]);
 
+/* Class of every size up to kListSizes[7], indexed by (size - 1) / DSIZE */
+const unsigned char kSmallClass[10] = { 0, 1, 2, 3, 4, 4, 5, 5, 6, 7 };
+
+/* kListSizes[kPow2Class] is the first class of the power-of-two run,
+   which ends at kListSizes[kPow2Class + kPow2Length - 1] = 1 << 18 */
+const int kPow2Class = 8;
+const int kPow2Length = 11;
+
+#ifndef MM_TLSF
+#define NUM_LISTS       kLength
+#else
+/*************************************************************************
+ * TLSF (two-level segregated fit) engine, selected with -DMM_TLSF
+ * The first level splits sizes by powers of two and the second level
+ * splits every power of two into TLSF_SL_COUNT equal ranges. Sizes below
+ * TLSF_SMALL_SIZE all share first level 0, in steps of DSIZE. A search
+ * rounds the request up to the next second-level range, so the head of
+ * any non-empty list it lands on fits and malloc and free are both O(1).
+*************************************************************************/
+#define TLSF_SL_LOG2    4
+#define TLSF_SL_COUNT   (1 << TLSF_SL_LOG2)
+#define TLSF_SMALL_LOG2 (TLSF_SL_LOG2 + 4)      /* DSIZE steps below it */
+#define TLSF_SMALL_SIZE (1 << TLSF_SMALL_LOG2)
+#define TLSF_FL_COUNT   (32 - TLSF_SMALL_LOG2 + 1)  /* up to 4 GiB */
+#define NUM_LISTS       (TLSF_FL_COUNT * TLSF_SL_COUNT)
+#endif
+
+/*************************************************************************
+ * Slabs
+ * A slab serves one of the first SLAB_CLASSES classes (up to 160 bytes).
+ * Its slab_t header sits at the start of the SLAB_SIZE aligned window and
+ * the slots follow at SLAB_HDR_SIZE. Slabs with a free slot are kept on a
+ * doubly linked partial list per class. slab_map has one bit per window
+ * of the first SLAB_MAP_SPAN bytes above slab_map_base.
+*************************************************************************/
+#define SLAB_LOG2       10
+#define SLAB_SIZE       (1 << SLAB_LOG2)
+#define SLAB_CLASSES    8
+#define SLAB_MAX_SIZE   160             /* kListSizes[SLAB_CLASSES - 1] */
+#define SLAB_MAX_SLOTS  64
+#define SLAB_HDR_SIZE   32              /* sizeof(slab_t), DSIZE aligned */
+#define SLAB_MAP_SPAN   ((size_t)1 << 32)
+
+typedef struct slab {
+    struct slab* prev;          /* partial list of the class */
+    struct slab* next;
+    uint32_t slot_size;
+    uint16_t nslots;
+    uint16_t nfree;
+    uint64_t used[SLAB_MAX_SLOTS / 64];
+} slab_t;
+
+/* Given a slab object pointer, compute the address of its slab */
+#define SLAB_OF(p)      ((slab_t *)((uintptr_t)(p) & ~(uintptr_t)(SLAB_SIZE - 1)))
+
+static slab_t* slab_partial[SLAB_CLASSES];
+static char* slab_map_base;
+/* Windows below this index may be marked. Written under heap_lock, read
+   without it by the frees, like the bytes of slab_map */
+static size_t slab_map_top;
+static uint8_t slab_map[SLAB_MAP_SPAN / SLAB_SIZE / 8];
+
+/*************************************************************************
+ * Quick lists
+ * Freed heap blocks of up to QUICK_MAX bytes wait on a LIFO list per exact
+ * size, linked through their next pointer and still marked as allocated,
+ * so neither neighbour sees them as free. quick_bytes sums their sizes.
+*************************************************************************/
+#define QUICK_MAX       512
+#define QUICK_BINS      (QUICK_MAX / DSIZE - 1)
+#define QUICK_INDEX(asize)  ((asize) / DSIZE - 2)
+#define QUICK_BYTES     (1 << 16)
+
+/*************************************************************************
+ * Heaps
+ * The main heap grows in the memlib region, and every arena in a mapping
+ * of its own that starts with the mm_arena_t. The heads of the lists sit
+ * at the start of the heap, the rest of their state in its heap_t. All
+ * the functions below work on the heap that heap points to: the main
+ * heap, but for an arena while an mm_arena_* call holds its lock.
+*************************************************************************/
+typedef struct {
+    char* lo;                   /* start of the heap */
+    char* brk;                  /* arenas only: end of the heap */
+    char* end;                  /* arenas only: end of the mapping */
+#ifndef MM_TLSF
+    uint32_t list_bitmap;       /* bit i is set iff list i is non-empty */
+#else
+    /* Bit f is set iff some list of first level f is non-empty */
+    uint32_t tlsf_fl_bitmap;
+    /* Bit s of entry f is set iff list (f, s) is non-empty */
+    uint32_t tlsf_sl_bitmap[TLSF_FL_COUNT];
+#endif
+    uintptr_t* quick_head[QUICK_BINS];
+    size_t quick_bytes;
+    void* remote;               /* blocks queued by remote_free */
+    mm_stats_t counters;        /* event counters, see STAT_INC */
+} heap_t;
+
+struct mm_arena {
+    heap_t heap;
+    pthread_mutex_t lock;
+    pthread_t owner;            /* the thread that created the arena */
+    size_t size;                /* of the mapping */
+};
+
+/* The arena header, rounded up so that its heap is aligned like the
+   main heap */
+#define ARENA_HDR_SIZE  (DSIZE * ((sizeof(mm_arena_t) + DSIZE - 1) / DSIZE))
+
+/* Default mapping size of mm_arena_create */
+#ifndef MM_ARENA_SIZE
+#define MM_ARENA_SIZE   ((size_t)1 << 30)
+#endif
+
+static heap_t main_heap;
+static __thread heap_t* heap = &main_heap;
+
+/* Address of the head pointer of list i at the start of the heap */
+#define LIST_HEAD(i)    ((uintptr_t *)heap->lo + (i))
+
+/*************************************************************************
+ * Per-CPU caches
+ * Slots of every slab class are cached per CPU, at most PCPU_COUNT per
+ * class, on a stack of slot pointers topped at count. A cached slot stays
+ * marked as used in its slab. Slots move between a cache and the slabs
+ * PCPU_BATCH at a time. Threads running on a CPU numbered MM_MAX_CPUS or
+ * more go to the slabs directly.
+*************************************************************************/
+#define PCPU_CLASSES    SLAB_CLASSES
+#define PCPU_COUNT      32
+#define PCPU_BATCH      (PCPU_COUNT / 2)
+
+#ifndef MM_MAX_CPUS
+#define MM_MAX_CPUS     256
+#endif
+
+typedef struct {
+    uintptr_t count[PCPU_CLASSES];
+    void* slots[PCPU_CLASSES][PCPU_COUNT];
+    pthread_mutex_t lock;       /* guards the cache where there is no rseq */
+} __attribute__((aligned(64))) pcpu_cache_t;
+
+/* The rseq area glibc (2.35 and later) registers for every thread: at
+   __rseq_offset from the thread pointer, unless __rseq_size is 0. Only the
+   CPU number and the critical section pointer are used */
+#if defined(__x86_64__) && defined(__linux__) && !defined(MM_NO_RSEQ)
+#define PCPU_RSEQ
+#define RSEQ_SIG        0x53053053
+extern const ptrdiff_t __rseq_offset __attribute__((weak));
+extern const unsigned int __rseq_size __attribute__((weak));
+#endif
+
+/* Event counters. Every heap counts its own under its lock, the main
+   heap under heap_lock and an arena under the arena's, and mm_stats
+   reports those of the main heap. mmap_bytes, which no lock guards, is
+   kept in the main heap with relaxed atomics. -DMM_NO_STATS compiles all
+   of them out */
+#ifndef MM_NO_STATS
+#define STAT_INC(field)         (heap->counters.field++)
+#define STAT_ADD(field, n)      __atomic_add_fetch(&main_heap.counters.field, (n), __ATOMIC_RELAXED)
+#else
+#define STAT_INC(field)         ((void)0)
+#define STAT_ADD(field, n)      ((void)0)
+#endif
+
+/* Options of the current heap, set by mm_init_options */
+static mm_options_t options = { MM_MMAP_THRESHOLD, MM_TRIM_THRESHOLD,
+                                MM_GROW_MIN, MM_GROW_PERCENT, MM_GROW_MAX,
+                                MM_FIT_POLICY, MM_FIT_TRIES };
+
+/* Bytes freed into the heap since memory was last given back */
+static size_t freed_since_trim;
+
+/* Guards the segregated lists, the slabs and the heap itself */
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Indexed by CPU number. Only the entries of CPUs in use are touched */
+static pcpu_cache_t pcpu[MM_MAX_CPUS];
+
 /**********************************************************
  * print_segregated_list
  * Helper function that prints out the state of the linked
  * list
  **********************************************************/
 void print_segregated_list(void) {
-    for (int i = 0; i < kLength; ++i) {
-        uintptr_t* cur = GET_PTR(mem_heap_lo() + i);
-        printf("%d: ->", kListSizes[i]);
+    for (int i = 0; i < NUM_LISTS; ++i) {
+        uintptr_t* cur = GET_PTR(LIST_HEAD(i));
+        printf("%d: ->", i);
         while (cur != NULL) {
             // Print out the size, pointer to prev, current address, and next
             printf("%lu (%p,%p,%p) -> ",
@@ -106,44 +415,240 @@ void print_segregated_list(void) {
     }
 }
 
+/**********************************************************
+ * get_size_class
+ * Find the smallest class of kListSizes that holds asize.
+ * Computed directly from the size, without scanning
+ * kListSizes
+ **********************************************************/
+int get_size_class(size_t asize) {
+    if (asize <= DSIZE)
+        return 0;
+    if (asize <= kListSizes[kPow2Class - 1])
+        return kSmallClass[(asize - 1) / DSIZE];
+    /* ceil(log2(asize)) */
+    int log2 = (int)(sizeof(size_t) * 8) - __builtin_clzl(asize - 1);
+    int idx = kPow2Class + log2 - __builtin_ctz(kListSizes[kPow2Class]);
+    if (idx < kPow2Class + kPow2Length)
+        return idx;
+    /* The last three classes grow by a factor of four */
+    if (log2 <= 20)
+        return kPow2Class + kPow2Length;
+    if (log2 <= 22)
+        return kPow2Class + kPow2Length + 1;
+    return kPow2Class + kPow2Length + 2;
+}
+
+#ifndef MM_TLSF
 /**********************************************************
  * get_appropriate_list
  * Find the linked-list that is appropriate to insert the
  * free block
  **********************************************************/
 int get_appropriate_list(size_t asize) {
-    for (int i = 0; i < kLength; ++i)
-        if (kListSizes[i] >= asize)
-            return i;
-    return -1;
+    return get_size_class(asize);
+}
+
+/**********************************************************
+ * search_lists
+ * Walk the non-empty lists of candidates in order for a
+ * block that fits asize: the first one, or the smallest
+ * of the first tries blocks looked at. Every block of a
+ * later list is bigger than those of an earlier one, so
+ * the search ends with the list that has a fit, and once
+ * tries is spent, the head of the next list is taken
+ **********************************************************/
+void* search_lists(uint32_t candidates, size_t asize, size_t tries, int first) {
+    uintptr_t *cur, *best = NULL;
+    size_t best_size = 0, steps = 0;
+    for (; candidates != 0; candidates &= candidates - 1) {
+        for (cur = GET_PTR(LIST_HEAD(__builtin_ctz(candidates)));
+             cur != NULL; cur = GET_PTR(GET_NEXT(cur))) {
+            size_t size = GET_SIZE(HDRP(cur));
+            STAT_INC(fit_steps);
+            if (size >= asize && (best == NULL || size < best_size)) {
+                best = cur;
+                best_size = size;
+                if (first || size == asize)
+                    return (void *)best;
+            }
+            if (++steps >= tries)
+                break;
+        }
+        if (best != NULL)
+            return (void *)best;
+    }
+    return NULL;
 }
 
 /**********************************************************
  * get_possible_list
- * Find the smallest linked-list that has a free block that
- * can DEFINITELY fit asize. Runtime O(1)
+ * Find a free block that fits asize with the fit policy
+ * of the options. Head-fit takes the head of the smallest
+ * list that may fit it, or else of the smallest that can
+ * DEFINITELY fit it. Runtime O(1): the non-empty lists
+ * are found through list_bitmap
  **********************************************************/
 void* get_possible_list(size_t asize) {
-    int i;
+    uint32_t candidates = heap->list_bitmap & (~0u << get_appropriate_list(asize));
     uintptr_t* cur = NULL;
-    for (i = 0; i < kLength; ++i) {
-        if (kListSizes[i] >= asize && GET_PTR((uintptr_t *)mem_heap_lo() + i) != NULL) {
-            cur = GET_PTR((uintptr_t *)mem_heap_lo() + i);
-            if (GET_SIZE(HDRP(cur)) >= asize)
-                return (void *)cur;
-            else
-                break;
-        }
+    switch (options.fit_policy) {
+    case MM_FIT_FIRST:
+        return search_lists(candidates, asize, SIZE_MAX, 1);
+    case MM_FIT_BEST_K:
+        return search_lists(candidates, asize, MAX(options.fit_tries, 1), 0);
+    case MM_FIT_BEST:
+        return search_lists(candidates, asize, SIZE_MAX, 0);
     }
-    for (i = 0; i < kLength; ++i) {
-        if (kListSizes[i] >= (asize << 1) && GET_PTR((uintptr_t *)mem_heap_lo() + i) != NULL) {
-            cur = GET_PTR((uintptr_t *)mem_heap_lo() + i); 
+    if (candidates != 0) {
+        cur = GET_PTR(LIST_HEAD(__builtin_ctz(candidates)));
+        STAT_INC(fit_steps);
+        if (GET_SIZE(HDRP(cur)) >= asize)
             return (void *)cur;
-        }
+    }
+    candidates = heap->list_bitmap & (~0u << get_appropriate_list(asize << 1));
+    if (candidates != 0) {
+        cur = GET_PTR(LIST_HEAD(__builtin_ctz(candidates)));
+        return (void *)cur;
     }
     return NULL;
 }
 
+/**********************************************************
+ * mark_list / unmark_list / list_is_marked
+ * Maintain the bitmap of non-empty lists
+ **********************************************************/
+void mark_list(int i) {
+    heap->list_bitmap |= 1u << i;
+}
+
+void unmark_list(int i) {
+    heap->list_bitmap &= ~(1u << i);
+}
+
+int list_is_marked(int i) {
+    return (heap->list_bitmap >> i) & 1;
+}
+
+void reset_list_marks(void) {
+    heap->list_bitmap = 0;
+}
+#else
+/**********************************************************
+ * tlsf_mapping
+ * Compute the first and second level indices of size.
+ * Sizes past the last first level go to the last list
+ **********************************************************/
+void tlsf_mapping(size_t size, int* fl, int* sl) {
+    if (size < TLSF_SMALL_SIZE) {
+        *fl = 0;
+        *sl = size / DSIZE;
+        return;
+    }
+    int log2 = (int)(sizeof(size_t) * 8) - 1 - __builtin_clzl(size);
+    *fl = log2 - TLSF_SMALL_LOG2 + 1;
+    *sl = (size >> (log2 - TLSF_SL_LOG2)) - TLSF_SL_COUNT;
+    if (*fl >= TLSF_FL_COUNT) {
+        *fl = TLSF_FL_COUNT - 1;
+        *sl = TLSF_SL_COUNT - 1;
+    }
+}
+
+/**********************************************************
+ * get_appropriate_list
+ * Find the linked-list that is appropriate to insert the
+ * free block
+ **********************************************************/
+int get_appropriate_list(size_t asize) {
+    int fl, sl;
+    tlsf_mapping(asize, &fl, &sl);
+    return fl * TLSF_SL_COUNT + sl;
+}
+
+/**********************************************************
+ * get_possible_list
+ * Round asize up to the next second-level range and take
+ * the head of the first non-empty list at or above it,
+ * which always fits. Runtime O(1)
+ **********************************************************/
+void* get_possible_list(size_t asize) {
+    size_t rounded = asize;
+    int fl, sl;
+    if (asize >= TLSF_SMALL_SIZE) {
+        int log2 = (int)(sizeof(size_t) * 8) - 1 - __builtin_clzl(asize);
+        rounded += ((size_t)1 << (log2 - TLSF_SL_LOG2)) - 1;
+    }
+    if (rounded >> (TLSF_SMALL_LOG2 + TLSF_FL_COUNT - 1)) {
+        /* Beyond the last first level: only its last list can fit */
+        uintptr_t* cur = GET_PTR(LIST_HEAD(NUM_LISTS - 1));
+        while (cur != NULL && GET_SIZE(HDRP(cur)) < asize) {
+            STAT_INC(fit_steps);
+            cur = GET_PTR(GET_NEXT(cur));
+        }
+        return (void *)cur;
+    }
+    tlsf_mapping(rounded, &fl, &sl);
+
+    uint32_t sl_map = heap->tlsf_sl_bitmap[fl] & (~0u << sl);
+    if (sl_map == 0) {
+        uint32_t fl_map = heap->tlsf_fl_bitmap & (~0u << (fl + 1));
+        if (fl_map == 0)
+            return NULL;
+        fl = __builtin_ctz(fl_map);
+        sl_map = heap->tlsf_sl_bitmap[fl];
+    }
+    return (void *)GET_PTR(LIST_HEAD(fl * TLSF_SL_COUNT + __builtin_ctz(sl_map)));
+}
+
+/**********************************************************
+ * mark_list / unmark_list / list_is_marked
+ * Maintain both levels of the bitmap of non-empty lists
+ **********************************************************/
+void mark_list(int i) {
+    heap->tlsf_sl_bitmap[i / TLSF_SL_COUNT] |= 1u << (i % TLSF_SL_COUNT);
+    heap->tlsf_fl_bitmap |= 1u << (i / TLSF_SL_COUNT);
+}
+
+void unmark_list(int i) {
+    heap->tlsf_sl_bitmap[i / TLSF_SL_COUNT] &= ~(1u << (i % TLSF_SL_COUNT));
+    if (heap->tlsf_sl_bitmap[i / TLSF_SL_COUNT] == 0)
+        heap->tlsf_fl_bitmap &= ~(1u << (i / TLSF_SL_COUNT));
+}
+
+int list_is_marked(int i) {
+    return (heap->tlsf_sl_bitmap[i / TLSF_SL_COUNT] >> (i % TLSF_SL_COUNT)) & 1;
+}
+
+void reset_list_marks(void) {
+    heap->tlsf_fl_bitmap = 0;
+    memset(heap->tlsf_sl_bitmap, 0, sizeof(heap->tlsf_sl_bitmap));
+}
+#endif
+
+/**********************************************************
+ * heap_sbrk / heap_hi / heap_size
+ * mem_sbrk, mem_heap_hi and mem_heapsize for the current
+ * heap. An arena grows within its mapping
+ **********************************************************/
+void* heap_sbrk(size_t incr) {
+    char* old_brk;
+    if (heap == &main_heap)
+        return mem_sbrk(incr);
+    old_brk = heap->brk;
+    if (incr > (size_t)(heap->end - heap->brk))
+        return (void *)-1;
+    heap->brk += incr;
+    return old_brk;
+}
+
+char* heap_hi(void) {
+    return heap == &main_heap ? (char *)mem_heap_hi() : heap->brk - 1;
+}
+
+size_t heap_size(void) {
+    return heap == &main_heap ? mem_heapsize() : (size_t)(heap->brk - heap->lo);
+}
+
 /**********************************************************
  * add_to_list
  * Adds a freed block to the linked-list.
@@ -151,17 +656,18 @@ void* get_possible_list(size_t asize) {
 void add_to_list(void* p) {
     int list_number = get_appropriate_list(GET_SIZE(HDRP(p)));
     /* Check to see if the linked-list is empty (head is null) */
-    uintptr_t* head = GET_PTR((uintptr_t *)mem_heap_lo() + list_number);
+    uintptr_t* head = GET_PTR(LIST_HEAD(list_number));
     if (head != NULL) {
         /* Set the next node to have its previous point here */
         PUT_PTR(GET_PREV(head), p);
     } 
     /* Point to the previous head of list */
-    PUT_PTR(GET_NEXT(p), GET_PTR((uintptr_t *)mem_heap_lo() + list_number));
+    PUT_PTR(GET_NEXT(p), GET_PTR(LIST_HEAD(list_number)));
     PUT_PTR(GET_PREV(p), NULL);
 
     /* Update head of list */
-    PUT_PTR((uintptr_t *)mem_heap_lo() + list_number, p);
+    PUT_PTR(LIST_HEAD(list_number), p);
+    mark_list(list_number);
 }
 
 /**********************************************************
@@ -171,10 +677,12 @@ void add_to_list(void* p) {
 void free_from_list(void* p) { 
     int list_number = get_appropriate_list(GET_SIZE(HDRP(p)));
     /* If it is at the head, we must change the head */
-    if (GET_PTR((uintptr_t *)mem_heap_lo() + list_number) == p) {
-        PUT_PTR((uintptr_t *)mem_heap_lo() + list_number, GET_PTR(GET_NEXT(p)));
+    if (GET_PTR(LIST_HEAD(list_number)) == p) {
+        PUT_PTR(LIST_HEAD(list_number), GET_PTR(GET_NEXT(p)));
         if (GET_PTR(GET_NEXT(p)) != NULL) {
             PUT_PTR(GET_PREV(GET_PTR(GET_NEXT(p))), NULL); 
+        } else {
+            unmark_list(list_number);
         }
     } else {
         PUT_PTR(GET_NEXT(GET_PTR(GET_PREV(p))), GET_PTR(GET_NEXT(p)));
@@ -187,30 +695,108 @@ void free_from_list(void* p) {
 }
 
 /**********************************************************
- * mm_init
- * Initialize the heap, including "allocation" of the
- * prologue and epilogue
+ * heap_init
+ * Lay out the empty lists, the prologue and the epilogue at
+ * the start of the current heap, which must be empty.
+ * Returns -1 if there is no room for them
  **********************************************************/
-int mm_init(void)
-{ 
-    // We need to allocate room for kLength pointers
-    int allocate_size = WSIZE * kLength;
-	void* heap_listp = NULL;
-    if ((heap_listp = mem_sbrk(4 * WSIZE + allocate_size + DSIZE)) == (void *)-1)
+int heap_init(void)
+{
+    // We need to allocate room for NUM_LISTS pointers
+    int allocate_size = WSIZE * NUM_LISTS;
+    char* heap_listp;
+    reset_list_marks();
+    memset(heap->quick_head, 0, sizeof(heap->quick_head));
+    heap->quick_bytes = 0;
+    heap->remote = NULL;
+    heap_listp = heap_sbrk(4 * WSIZE + allocate_size + DSIZE);
+    if (heap_listp == (void *)-1)
         return -1;
- 
-    for (int i = 0; i < kLength + 1; ++i) {
+
+    for (int i = 0; i < NUM_LISTS + 1; ++i) {
         PUT_PTR((uintptr_t*)heap_listp + i, NULL);    // Set the initial values to NULL
     }
     heap_listp += allocate_size;
     PUT(heap_listp + (0 * WSIZE ), 0);
-    PUT(heap_listp + (1 * WSIZE ), PACK(DSIZE * 2, 1));   // prologue header
+    PUT(heap_listp + (1 * WSIZE ), PACK(DSIZE * 2, PREV_ALLOC | 1));   // prologue header
+    PUT_PTR(heap_listp + (2 * WSIZE ), NULL);                          // prologue prev
+    PUT_PTR(heap_listp + (3 * WSIZE ), NULL);                          // prologue next
     PUT(heap_listp + (2 * WSIZE + DSIZE), PACK(DSIZE * 2, 1));   // prologue footer
-    PUT(heap_listp + (3 * WSIZE + DSIZE), PACK(0, 1));    // epilogue header
-    heap_listp += DSIZE + DSIZE;
+    PUT(heap_listp + (3 * WSIZE + DSIZE), PACK(0, PREV_ALLOC | 1));    // epilogue header
     return 0;
 }
 
+/**********************************************************
+ * mm_default_options
+ * Fill opts with the options mm_init uses
+ **********************************************************/
+void mm_default_options(mm_options_t *opts)
+{
+    opts->mmap_threshold = MM_MMAP_THRESHOLD;
+    opts->trim_threshold = MM_TRIM_THRESHOLD;
+    opts->grow_min = MM_GROW_MIN;
+    opts->grow_percent = MM_GROW_PERCENT;
+    opts->grow_max = MM_GROW_MAX;
+    opts->fit_policy = MM_FIT_POLICY;
+    opts->fit_tries = MM_FIT_TRIES;
+}
+
+/**********************************************************
+ * mm_init
+ * Initialize the heap with the default options
+ **********************************************************/
+int mm_init(void)
+{
+    return mm_init_options(NULL);
+}
+
+void pcpu_clear(void);
+
+/**********************************************************
+ * mm_init_options
+ * Initialize the heap, including "allocation" of the
+ * prologue and epilogue. A NULL opts means the defaults
+ **********************************************************/
+int mm_init_options(const mm_options_t *opts)
+{ 
+    int result;
+    pthread_mutex_lock(&heap_lock);
+    if (opts != NULL)
+        options = *opts;
+    else
+        mm_default_options(&options);
+    pcpu_clear();
+    freed_since_trim = 0;
+    memset(slab_partial, 0, sizeof(slab_partial));
+    memset(&main_heap.counters, 0, sizeof(main_heap.counters));
+    memset(slab_map, 0, (slab_map_top + 7) / 8);
+    __atomic_store_n(&slab_map_top, 0, __ATOMIC_RELAXED);
+    main_heap.lo = mem_heap_lo();
+    slab_map_base = (char *)((uintptr_t)main_heap.lo & ~(uintptr_t)(SLAB_SIZE - 1));
+    result = heap_init();
+    pthread_mutex_unlock(&heap_lock);
+    return result;
+}
+
+/**********************************************************
+ * mark_allocated / mark_free
+ * Write the header of block bp, keeping its PREV_ALLOC bit,
+ * the footer if the block is free, and the PREV_ALLOC bit
+ * of the next block
+ **********************************************************/
+void mark_allocated(void* bp, size_t size)
+{
+    PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp)) | 1));
+    SET_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+}
+
+void mark_free(void* bp, size_t size)
+{
+    PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));
+    PUT(FTRP(bp), PACK(size, 0));
+    CLR_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+}
+
 /**********************************************************
  * coalesce
  * Covers the 4 cases discussed in the text:
@@ -218,24 +804,27 @@ int mm_init(void)
  * - the next block is available for coalescing
  * - the previous block is available for coalescing
  * - both neighbours are available for coalescing
+ * bp must already be marked free (see mark_free)
  **********************************************************/
 void *coalesce(void *bp)
 {
-    size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp)));
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
     size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
     size_t size = GET_SIZE(HDRP(bp));
 
     if (prev_alloc && next_alloc) {       /* Case 1 */
+        STAT_INC(coalesces[0]);
         add_to_list(bp);
         return bp;
     }
 
     else if (prev_alloc && !next_alloc) { /* Case 2 */
+        STAT_INC(coalesces[1]);
         int next_size = GET_SIZE(HDRP(NEXT_BLKP(bp)));
         /* Remove the next block from the appropriate ll */
         free_from_list(NEXT_BLKP(bp));
         size += next_size;
-        PUT(HDRP(bp), PACK(size, 0));
+        PUT(HDRP(bp), PACK(size, prev_alloc));
         PUT(FTRP(bp), PACK(size, 0));
 
         /* Add the current block, with newly updated size, to the app ll */
@@ -244,31 +833,35 @@ void *coalesce(void *bp)
     }
 
     else if (!prev_alloc && next_alloc) { /* Case 3 */
-        int prev_size = GET_SIZE(HDRP(PREV_BLKP(bp)));
+        STAT_INC(coalesces[2]);
+        void* prev = PREV_BLKP(bp);
+        int prev_size = GET_SIZE(HDRP(prev));
         /* Remove the previous block from the appropriate ll */
-        free_from_list(PREV_BLKP(bp));
+        free_from_list(prev);
         size += prev_size;
-        PUT(FTRP(bp), PACK(size, 0));
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
+        PUT(HDRP(prev), PACK(size, GET_PREV_ALLOC(HDRP(prev))));
+        PUT(FTRP(prev), PACK(size, 0));
 
         /* Add previous block, with newly updated size, to the app ll */
-        add_to_list(PREV_BLKP(bp));
-        return (PREV_BLKP(bp));
+        add_to_list(prev);
+        return (prev);
     }
 
     else {            /* Case 4 */
+        STAT_INC(coalesces[3]);
         /* Remove next and prev block from their appropriate ll */
-        int next_size = GET_SIZE(FTRP(NEXT_BLKP(bp)));
-        int prev_size = GET_SIZE(HDRP(PREV_BLKP(bp)));
-        free_from_list(PREV_BLKP(bp));
+        void* prev = PREV_BLKP(bp);
+        int next_size = GET_SIZE(HDRP(NEXT_BLKP(bp)));
+        int prev_size = GET_SIZE(HDRP(prev));
+        free_from_list(prev);
         free_from_list(NEXT_BLKP(bp));
         size += next_size + prev_size;
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size,0));
-        PUT(FTRP(NEXT_BLKP(bp)), PACK(size,0));
+        PUT(HDRP(prev), PACK(size, GET_PREV_ALLOC(HDRP(prev))));
+        PUT(FTRP(prev), PACK(size, 0));
 
         // Add previous block, with newly updated size, to the appropriate ll
-        add_to_list(PREV_BLKP(bp));
-        return (PREV_BLKP(bp));
+        add_to_list(prev);
+        return (prev);
     }
 }
 
@@ -286,24 +879,25 @@ void *extend_heap(size_t words)
     /* Allocate an even number of words to maintain alignments */
     size = (words % 2) ? (words+1) * WSIZE : words * WSIZE;
 
-	void* last_blk_ft = mem_heap_hi() + 1 - DSIZE;
-	void* last_blk_hd = last_blk_ft - GET_SIZE(last_blk_ft) + WSIZE;
-    if (!GET_ALLOC(last_blk_hd)) {
-      if (size <= GET_SIZE(last_blk_hd)) {
-        return last_blk_hd + DSIZE + WSIZE;
+    char* epilogue = heap_hi() + 1 - WSIZE;
+    if (!GET_PREV_ALLOC(epilogue)) {
+      size_t last_size = GET_SIZE(epilogue - WSIZE);
+      if (size <= last_size) {
+        return epilogue - last_size + DSIZE + WSIZE;
       } else {
         /* The last block in the heap is free, and can be used to coalesce with
            the to-be-allocated block */
-        size -= GET_SIZE(last_blk_hd);
+        size -= last_size;
       }
     }
 
-    if ((bp = mem_sbrk(size)) == (void *)-1)
+    if ((bp = heap_sbrk(size)) == (void *)-1)
         return NULL;
+    STAT_INC(extend_heap_calls);
     bp += DSIZE;
 
     /* Initialize free block header/footer and the epilogue header */
-    PUT(HDRP(bp), PACK(size, 0));                // free block header
+    PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));  // free block header
     PUT(GET_PREV(bp), -1);                       // set prev to NULL
     PUT(GET_NEXT(bp), -1);                       // set next to NULL
     PUT(FTRP(bp), PACK(size, 0));                // free block footer
@@ -314,6 +908,19 @@ void *extend_heap(size_t words)
     return coalesce(bp);
 }
 
+/**********************************************************
+ * grow_size
+ * How many bytes the heap grows by for a block of need
+ * bytes: grow_percent of the heap size, but at least
+ * grow_min and at most grow_max, and never less than need
+ **********************************************************/
+size_t grow_size(size_t need)
+{
+    size_t step = heap_size() / 100 * options.grow_percent;
+    step = MIN(MAX(step, options.grow_min), options.grow_max);
+    return DSIZE * ((MAX(step, need) + DSIZE - 1) / DSIZE);
+}
+
 /**********************************************************
  * place
  * Mark the block as allocated
@@ -322,8 +929,7 @@ void place(void* bp, size_t asize)
 {
     size_t bsize = GET_SIZE(HDRP(bp));
     free_from_list(bp);
-    PUT(HDRP(bp), PACK(bsize, 1));
-    PUT(FTRP(bp), PACK(bsize, 1));
+    mark_allocated(bp, bsize);
 }
 
 /**********************************************************
@@ -337,27 +943,94 @@ void* separate_if_applicable(void* bp, size_t asize) {
 	size_t bsize = GET_SIZE(hdr_addr);
     /* Overhead consists of two pointer, header, and footer (4 * WSIZE) */
 	if (bsize > asize + (WSIZE << 2)) {
+		STAT_INC(splits);
 		free_from_list(bp);
 		size_t csize = bsize - asize;
 
 		// First block allocated
-		PUT(HDRP(bp), PACK(asize, 1));
-		PUT(FTRP(bp), PACK(asize, 1));
+		PUT(HDRP(bp), PACK(asize, GET_PREV_ALLOC(HDRP(bp)) | 1));
 
 		// Second block unallocated
-		PUT(HDRP(NEXT_BLKP(bp)), PACK(csize, 0));
+		PUT(HDRP(NEXT_BLKP(bp)), PACK(csize, PREV_ALLOC));
 		PUT(FTRP(NEXT_BLKP(bp)), PACK(csize, 0));
 		add_to_list(NEXT_BLKP(bp));
 		return bp;
 	} else if (bsize >= asize) {
 		free_from_list(bp);
-		PUT(HDRP(bp), PACK(bsize, 1));
-		PUT(FTRP(bp), PACK(bsize, 1));
+		mark_allocated(bp, bsize);
 		return bp;
 	}
 	return NULL;
 }
 
+/**********************************************************
+ * split_tail
+ * Given an allocated block bp of at least asize bytes, give
+ * the bytes past asize back as a free block if they are big
+ * enough to hold one. The caller holds heap_lock.
+ **********************************************************/
+void split_tail(void* bp, size_t asize) {
+    size_t bsize = GET_SIZE(HDRP(bp));
+    void* tail;
+    if (bsize <= asize + (WSIZE << 2))
+        return;
+    STAT_INC(splits);
+
+    PUT(HDRP(bp), PACK(asize, GET_PREV_ALLOC(HDRP(bp)) | 1));
+    tail = NEXT_BLKP(bp);
+    PUT(HDRP(tail), PACK(bsize - asize, PREV_ALLOC));
+    mark_free(tail, bsize - asize);
+    coalesce(tail);
+}
+
+/**********************************************************
+ * quick_push / quick_pop
+ * Put a freed block on the quick list of its size, or take
+ * a block of exactly asize bytes off it (NULL if empty).
+ * Blocks on a quick list stay marked as allocated.
+ * The caller holds heap_lock.
+ **********************************************************/
+void quick_consolidate(void);
+
+void quick_push(void* bp, size_t size) {
+    int i = QUICK_INDEX(size);
+    PUT_PTR(GET_NEXT(bp), heap->quick_head[i]);
+    heap->quick_head[i] = bp;
+    heap->quick_bytes += size;
+    if (heap->quick_bytes > QUICK_BYTES)
+        quick_consolidate();
+}
+
+void* quick_pop(size_t asize) {
+    int i = QUICK_INDEX(asize);
+    uintptr_t* bp = heap->quick_head[i];
+    if (bp != NULL) {
+        heap->quick_head[i] = GET_PTR(GET_NEXT(bp));
+        PUT_PTR(GET_NEXT(bp), NULL);
+        heap->quick_bytes -= asize;
+    }
+    return bp;
+}
+
+/**********************************************************
+ * quick_consolidate
+ * Free every block on the quick lists for real, coalescing
+ * each with its neighbours.
+ * The caller holds heap_lock.
+ **********************************************************/
+void quick_consolidate(void) {
+    for (int i = 0; i < QUICK_BINS; ++i) {
+        while (heap->quick_head[i] != NULL) {
+            uintptr_t* bp = heap->quick_head[i];
+            heap->quick_head[i] = GET_PTR(GET_NEXT(bp));
+            PUT_PTR(GET_NEXT(bp), NULL);
+            mark_free(bp, GET_SIZE(HDRP(bp)));
+            coalesce(bp);
+        }
+    }
+    heap->quick_bytes = 0;
+}
+
 /**********************************************************
  * find_fit
  * Traverse the heap searching for a block to fit asize
@@ -369,6 +1042,12 @@ void* find_fit(size_t asize)
     /* Determine the minimum size block we need, and pick the segregated list
        to check */
     void *bp = get_possible_list(asize);
+    STAT_INC(fit_searches);
+    if (bp == NULL && heap->quick_bytes != 0) {
+        /* Coalesced quick blocks may fit */
+        quick_consolidate();
+        bp = get_possible_list(asize);
+    }
     if (bp == NULL) {
         return NULL;
     }
@@ -376,153 +1055,1420 @@ void* find_fit(size_t asize)
 }
 
 /**********************************************************
- * mm_free
- * Free the block and coalesce with neighbouring blocks
+ * release_pages
+ * Drop the whole pages inside free block bp. Its header,
+ * list pointers and footer stay in place. Returns 1 if any
+ * page was released
  **********************************************************/
-void mm_free(void *bp)
+int release_pages(void* bp)
 {
-    if (bp == NULL){
-      return;
+    uintptr_t page = mem_pagesize();
+    uintptr_t lo = ((uintptr_t)bp + page - 1) & ~(page - 1);
+    uintptr_t hi = (uintptr_t)FTRP(bp) & ~(page - 1);
+    if (hi <= lo)
+        return 0;
+    return madvise((void *)lo, hi - lo, MADV_DONTNEED) == 0;
+}
+
+/**********************************************************
+ * trim_top
+ * Shrink the heap past the free block at its top, keeping
+ * pad bytes of it. Without mem_shrink, only its pages are
+ * released. Returns 1 if any memory was released.
+ * The caller holds heap_lock.
+ **********************************************************/
+int trim_top(size_t pad)
+{
+    char* epilogue = (char *)mem_heap_hi() + 1 - WSIZE;
+    if (GET_PREV_ALLOC(epilogue))
+        return 0;
+    size_t size = GET_SIZE(epilogue - WSIZE);
+    void* bp = epilogue - size + WSIZE + DSIZE;
+    size_t keep = pad == 0 ? 0 : MAX(DSIZE * ((pad + DSIZE - 1) / DSIZE), 2 * DSIZE);
+    if (mem_shrink == NULL)
+        return release_pages(bp);
+    if (size < keep + mem_pagesize())
+        return 0;
+
+    free_from_list(bp);
+    if (mem_shrink(size - keep) != 0) {
+        add_to_list(bp);
+        return release_pages(bp);
+    }
+    if (keep != 0) {
+        PUT(HDRP(bp), PACK(keep, GET_PREV_ALLOC(HDRP(bp))));
+        PUT(FTRP(bp), PACK(keep, 0));
+        PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1));
+        add_to_list(bp);
+    } else {
+        PUT(HDRP(bp), PACK(0, GET_PREV_ALLOC(HDRP(bp)) | 1));
     }
+    return 1;
+}
+
+/**********************************************************
+ * free_locked
+ * Free the block and coalesce with neighbouring blocks, or
+ * put it on a quick list if it is small.
+ * A result of at least trim_threshold in the main heap goes
+ * back to the OS, except for one growth step at its top.
+ * The caller holds heap_lock.
+ **********************************************************/
+void free_locked(void *bp)
+{
     size_t size = GET_SIZE(HDRP(bp));
-    PUT(HDRP(bp), PACK(size,0));
-    PUT(FTRP(bp), PACK(size,0));
-    coalesce(bp);
+    if (size <= QUICK_MAX) {
+        quick_push(bp, size);
+        return;
+    }
+    mark_free(bp, size);
+    bp = coalesce(bp);
+    if (options.trim_threshold == 0 || heap != &main_heap)
+        return;
+    /* Rate limit: at most one release per trim_threshold bytes freed, so
+       a block that is freed and reused over and over is not faulted in
+       again on every reuse */
+    freed_since_trim += size;
+    if (freed_since_trim >= options.trim_threshold &&
+        GET_SIZE(HDRP(bp)) >= options.trim_threshold) {
+        if (GET_SIZE(HDRP(NEXT_BLKP(bp))) == 0)
+            trim_top(grow_size(0));
+        else
+            release_pages(bp);
+        freed_since_trim = 0;
+    }
+}
+
+/**********************************************************
+ * remote_free
+ * Queue block bp to be freed into heap h by the next thread
+ * that allocates from it, without taking the lock of h. The
+ * queue is a lock-free stack linked through the payloads,
+ * which remote_drain empties as a whole, so a block cannot
+ * be popped while another thread looks at it
+ **********************************************************/
+void remote_free(heap_t* h, void* bp)
+{
+    void* head = __atomic_load_n(&h->remote, __ATOMIC_RELAXED);
+    do {
+        PUT_PTR(bp, head);
+    } while (!__atomic_compare_exchange_n(&h->remote, &head, bp, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/**********************************************************
+ * remote_drain
+ * Free the blocks queued on the current heap into its lists.
+ * The caller holds the lock of the heap.
+ **********************************************************/
+void remote_drain(void)
+{
+    uintptr_t* bp;
+    if (__atomic_load_n(&heap->remote, __ATOMIC_RELAXED) == NULL)
+        return;
+    bp = __atomic_exchange_n(&heap->remote, NULL, __ATOMIC_ACQUIRE);
+    while (bp != NULL) {
+        uintptr_t* next = GET_PTR(bp);
+        free_locked(bp);
+        bp = next;
+    }
 }
 
 /*********************************************************
  * get_adjusted_size adjusts the block size to account for
- * overhead, pointers, and alignment
+ * overhead (header and pointers, no footer), and alignment.
+ * A block is never smaller than a free block with a footer
  *********************************************************/
 size_t get_adjusted_size(size_t size) {
-    size_t asize;
-    if (size <= DSIZE)
-        asize = 2 * DSIZE;
-    else
-        asize = DSIZE * ((size + (DSIZE) + (DSIZE-1))/ DSIZE);
-    /* Add the following extra DSIZE for linked list structure */
-    asize += DSIZE;
-    return asize;
+    size_t asize = DSIZE * ((size + WSIZE + DSIZE + (DSIZE-1)) / DSIZE);
+    return MAX(asize, 2 * DSIZE);
 }
 
 /**********************************************************
- * mm_malloc
- * Allocate a block of size bytes.
- * The type of search is determined by find_fit
- * The decision of splitting the block, or not is determined
- *   in place(..)
- * If no block satisfies the request, the heap is extended
+ * malloc_locked
+ * Allocate a block of asize bytes from the segregated lists,
+ * extending the heap if no block fits.
+ * The caller holds heap_lock.
  **********************************************************/
-void *mm_malloc(size_t size)
+void* malloc_locked(size_t asize)
 {
-    if (DEBUG) {
-        mm_check();
-    } 
-    size_t asize; /* adjusted block size */
-    size_t extendsize; /* amount to extend heap if no fit */
     char * bp;
 
-    /* Ignore spurious requests */
-    if (size == 0)
-        return NULL;
+    remote_drain();
 
-    asize = get_adjusted_size(size);
+    /* A block freed with this very size is the quickest fit */
+    if (asize <= QUICK_MAX && (bp = quick_pop(asize)) != NULL) {
+        STAT_INC(quick_hits);
+        return bp;
+    }
 
     /* Search the free list for a fit */
     if ((bp = find_fit(asize)) != NULL) { 
         return bp;
     }
 
-    /* No fit found. Get more memory and place the block */
-    extendsize = MAX(asize, CHUNKSIZE);
-    if ((bp = extend_heap(extendsize/WSIZE)) == NULL)
+    /* No fit found. Get more memory and place the block; the rest of the
+       growth step goes back to the lists */
+    if ((bp = extend_heap(grow_size(asize)/WSIZE)) == NULL)
         return NULL;
 
-    place(bp, asize);
-    return bp;
+    return separate_if_applicable(bp, asize);
+}
 
+/**********************************************************
+ * aligned_payload
+ * The first align-aligned address at or after bp that leaves
+ * a leading fragment that is empty or big enough to be a
+ * free block of its own (2 * DSIZE)
+ **********************************************************/
+char* aligned_payload(void* bp, size_t align) {
+    char* aligned = (char *)(((uintptr_t)bp + align - 1) & ~(uintptr_t)(align - 1));
+    if (aligned != bp && aligned - (char *)bp < 2 * DSIZE)
+        aligned += align;
+    return aligned;
 }
 
 /**********************************************************
- * mm_realloc
- * Implemented simply in terms of mm_malloc and mm_free
- *********************************************************/
-void *mm_realloc(void *ptr, size_t size)
-{
-    /* If size == 0 then this is just free, and we return NULL. */
-    if (size == 0){
-        mm_free(ptr);
-        return NULL;
-    }
-    /* If ptr is NULL, then this is just malloc. */
-    if (ptr == NULL) {
-        return (mm_malloc(size));
+ * find_aligned_fit
+ * Search the segregated lists, ALIGNED_FIT_TRIES blocks per
+ * list, for a free block with room for an align-aligned
+ * payload of asize bytes. Return it allocated, or NULL.
+ * The caller holds heap_lock.
+ **********************************************************/
+void* find_aligned_fit(size_t asize, size_t align) {
+    for (int i = get_appropriate_list(asize); i < NUM_LISTS; ++i) {
+        if (!list_is_marked(i))
+            continue;
+        uintptr_t* cur = GET_PTR(LIST_HEAD(i));
+        for (int n = 0; cur != NULL && n < ALIGNED_FIT_TRIES; ++n) {
+            STAT_INC(fit_steps);
+            if (aligned_payload(cur, align) - (char *)cur + asize <= GET_SIZE(HDRP(cur))) {
+                place(cur, asize);
+                return cur;
+            }
+            cur = GET_PTR(GET_NEXT(cur));
+        }
     }
-    void *newptr;
-    size_t cur_size;
-    size_t asize;
-
-    cur_size = GET_SIZE(HDRP(ptr));
-    asize = get_adjusted_size(size);  
+    return NULL;
+}
 
-	/* If the desired size is less than the current size, then simply return.
-	   For a general implementation of malloc, it might make sense to divide the
-	   resulting block up. For the testcases here however, it reduces utilization. */
-    if (asize < cur_size) {
-        return ptr;
-    }
-    /* Check to see if there is room (free block) in front of the block */
-    size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(ptr)));
-    size_t next_size = GET_SIZE(HDRP(NEXT_BLKP(ptr)));
-    if (!next_alloc) {
-        void* next_block = NEXT_BLKP(ptr); 
-        if (cur_size + next_size >= asize) {
-            /* Use the room since it is sufficient */
-            free_from_list(next_block);
-            PUT(HDRP(ptr), PACK(cur_size + next_size, 1));
-            PUT(FTRP(ptr), PACK(cur_size + next_size, 1));
-            return ptr; 
-        }
+/**********************************************************
+ * carve_aligned
+ * Given an allocated block bp with room for an align-aligned
+ * payload of asize bytes after a leading fragment that is
+ * empty or at least 2 * DSIZE, free the leading fragment
+ * and the tail and return the aligned block.
+ * The caller holds heap_lock.
+ **********************************************************/
+void* carve_aligned(void* bp, size_t asize, size_t align) {
+    size_t bsize = GET_SIZE(HDRP(bp));
+    char* aligned = aligned_payload(bp, align);
+    size_t lead = aligned - (char *)bp;
+    size_t rest = bsize - lead;
+
+    if (lead != 0) {
+        PUT(HDRP(aligned), PACK(rest, 1));
+        PUT_PTR(GET_PREV(aligned), NULL);
+        PUT_PTR(GET_NEXT(aligned), NULL);
+        PUT(HDRP(bp), PACK(lead, GET_PREV_ALLOC(HDRP(bp))));
+        PUT(FTRP(bp), PACK(lead, 0));
+        coalesce(bp);
     }
+    split_tail(aligned, asize);
+    return aligned;
+}
 
-    /* If the given block that you want to extend is at the end of the heap,
-       then extend the heap by the minimal amount */
-    void* last_blk_ft = mem_heap_hi() + 1 - DSIZE;
-    void* last_blk_hd = last_blk_ft - GET_SIZE(last_blk_ft) + WSIZE;
-
-    if (HDRP(ptr) == last_blk_hd) {
-        /* Only extend heap by the subtracted amount */
-        size_t extendsize = asize - GET_SIZE(last_blk_hd); 
-        if ((newptr = mem_sbrk(extendsize)) == (void *)-1)
+/**********************************************************
+ * malloc_aligned_locked
+ * Allocate a block of asize bytes whose payload is aligned
+ * to align (a power of two). When the heap has to grow, the
+ * growth step starts with the aligned block.
+ * The caller holds heap_lock.
+ **********************************************************/
+void* malloc_aligned_locked(size_t asize, size_t align) {
+    remote_drain();
+    void* bp = find_aligned_fit(asize, align);
+    if (bp == NULL)
+        bp = find_fit(asize + align + 2 * DSIZE);
+    if (bp == NULL) {
+        /* The extension starts at the last block if it is free, and
+           at the epilogue otherwise */
+        char* epilogue = heap_hi() + 1 - WSIZE;
+        char* start = epilogue + WSIZE + DSIZE;
+        if (!GET_PREV_ALLOC(epilogue))
+            start -= GET_SIZE(epilogue - WSIZE);
+        char* aligned = aligned_payload(start, align);
+        size_t need = (aligned - start) + asize;
+        if ((bp = extend_heap(grow_size(need) / WSIZE)) == NULL)
+            return NULL;
+        place(bp, need);
+    }
+    return carve_aligned(bp, asize, align);
+}
+
+/**********************************************************
+ * slab_is_marked / slab_mark
+ * Look up and update the bit of slab_map for the window
+ * starting at p
+ **********************************************************/
+int slab_is_marked(void* p) {
+    size_t idx = ((char *)p - slab_map_base) >> SLAB_LOG2;
+    if ((char *)p < slab_map_base ||
+        idx >= __atomic_load_n(&slab_map_top, __ATOMIC_RELAXED))
+        return 0;
+    return (__atomic_load_n(&slab_map[idx / 8], __ATOMIC_RELAXED) >> (idx % 8)) & 1;
+}
+
+void slab_mark(void* p, int used) {
+    size_t idx = ((char *)p - slab_map_base) >> SLAB_LOG2;
+    if (used) {
+        __atomic_fetch_or(&slab_map[idx / 8], 1u << (idx % 8), __ATOMIC_RELAXED);
+        if (idx >= slab_map_top)
+            __atomic_store_n(&slab_map_top, idx + 1, __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_and(&slab_map[idx / 8], ~(1u << (idx % 8)), __ATOMIC_RELAXED);
+    }
+}
+
+/**********************************************************
+ * is_slab_ptr
+ * Does the payload pointer p belong to a slab? Safe without
+ * heap_lock for any live pointer
+ **********************************************************/
+int is_slab_ptr(void* p) {
+    return slab_is_marked(SLAB_OF(p));
+}
+
+/**********************************************************
+ * slab_link / slab_unlink
+ * Add or remove a slab on the partial list of class idx
+ **********************************************************/
+void slab_link(slab_t* s, int idx) {
+    s->prev = NULL;
+    s->next = slab_partial[idx];
+    if (s->next != NULL)
+        s->next->prev = s;
+    slab_partial[idx] = s;
+}
+
+void slab_unlink(slab_t* s, int idx) {
+    if (s->prev != NULL)
+        s->prev->next = s->next;
+    else
+        slab_partial[idx] = s->next;
+    if (s->next != NULL)
+        s->next->prev = s->prev;
+    s->prev = s->next = NULL;
+}
+
+/**********************************************************
+ * slab_create
+ * Carve a new slab for class idx out of the heap. Returns
+ * NULL if the heap is exhausted or the window cannot be
+ * recorded in slab_map.
+ * The caller holds heap_lock.
+ **********************************************************/
+slab_t* slab_create(int idx) {
+    void* bp = malloc_aligned_locked(get_adjusted_size(SLAB_SIZE), SLAB_SIZE);
+    if (bp == NULL)
+        return NULL;
+    if ((size_t)((char *)bp - slab_map_base) >= SLAB_MAP_SPAN) {
+        free_locked(bp);
+        return NULL;
+    }
+    slab_t* s = bp;
+    s->slot_size = kListSizes[idx];
+    s->nslots = MIN((SLAB_SIZE - SLAB_HDR_SIZE) / s->slot_size, SLAB_MAX_SLOTS);
+    s->nfree = s->nslots;
+    memset(s->used, 0, sizeof(s->used));
+    slab_mark(s, 1);
+    slab_link(s, idx);
+    return s;
+}
+
+/**********************************************************
+ * slab_alloc
+ * Take a free slot of class idx, creating a slab if none of
+ * the class has one. Returns NULL if no slab can be made.
+ * The caller holds heap_lock.
+ **********************************************************/
+void* slab_alloc(int idx) {
+    slab_t* s = slab_partial[idx];
+    if (s == NULL && (s = slab_create(idx)) == NULL)
+        return NULL;
+    int w = 0;
+    while (s->used[w] == ~(uint64_t)0)
+        ++w;
+    int slot = w * 64 + __builtin_ctzl(~s->used[w]);
+    s->used[w] |= (uint64_t)1 << (slot % 64);
+    if (--s->nfree == 0)
+        slab_unlink(s, idx);
+    return (char *)s + SLAB_HDR_SIZE + (size_t)slot * s->slot_size;
+}
+
+/**********************************************************
+ * slab_free
+ * Release the slot p. An empty slab goes back to the heap,
+ * unless it is the only slab of its class with free slots.
+ * The caller holds heap_lock.
+ **********************************************************/
+void slab_free(void* p) {
+    slab_t* s = SLAB_OF(p);
+    int idx = get_size_class(s->slot_size);
+    int slot = ((char *)p - (char *)s - SLAB_HDR_SIZE) / s->slot_size;
+    s->used[slot / 64] &= ~((uint64_t)1 << (slot % 64));
+    if (s->nfree++ == 0)
+        slab_link(s, idx);
+    if (s->nfree == s->nslots && (s->prev != NULL || s->next != NULL)) {
+        slab_unlink(s, idx);
+        slab_mark(s, 0);
+        free_locked(s);
+    }
+}
+
+/**********************************************************
+ * use_mmap
+ * Should a request of size bytes get a mapping of its own?
+ **********************************************************/
+int use_mmap(size_t size) {
+    return options.mmap_threshold != 0 && size >= options.mmap_threshold;
+}
+
+/**********************************************************
+ * mmap_length
+ * Length of the mapping that holds size payload bytes at
+ * offset bytes into it
+ **********************************************************/
+size_t mmap_length(size_t offset, size_t size) {
+    size_t page = mem_pagesize();
+    return (offset + size + page - 1) & ~(page - 1);
+}
+
+/**********************************************************
+ * mmap_alloc
+ * Map a block of its own for size bytes. The header sits
+ * at the usual place, so bp is 2 * DSIZE into the mapping
+ **********************************************************/
+void* mmap_alloc(size_t size) {
+    size_t len = mmap_length(2 * DSIZE, size);
+    char* m = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (m == MAP_FAILED)
+        return NULL;
+    STAT_ADD(mmap_bytes, len);
+    PUT(m + WSIZE, PACK(len, MMAPPED | 1));
+    return m + 2 * DSIZE;
+}
+
+/**********************************************************
+ * mmap_alloc_aligned
+ * mmap_alloc with bp aligned to align (a power of two). The
+ * mapping is made align bytes longer, then the pages before
+ * MMAP_BASE(bp) and after the payload are unmapped
+ **********************************************************/
+void* mmap_alloc_aligned(size_t size, size_t align) {
+    size_t span = mmap_length(2 * DSIZE + align, size);
+    char* m = mmap(NULL, span, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (m == MAP_FAILED)
+        return NULL;
+    char* bp = (char *)(((uintptr_t)m + 2 * DSIZE + align - 1) & ~(uintptr_t)(align - 1));
+    char* base = MMAP_BASE(bp);
+    size_t len = mmap_length(bp - base, size);
+    if (base != m)
+        munmap(m, base - m);
+    if (base + len != m + span)
+        munmap(base + len, m + span - (base + len));
+    STAT_ADD(mmap_bytes, len);
+    PUT(HDRP(bp), PACK(len, MMAPPED | 1));
+    return bp;
+}
+
+/**********************************************************
+ * mmap_free
+ * Give the mapping of bp back to the OS
+ **********************************************************/
+void mmap_free(void* bp) {
+    STAT_ADD(mmap_bytes, -GET_SIZE(HDRP(bp)));
+    munmap(MMAP_BASE(bp), GET_SIZE(HDRP(bp)));
+}
+
+/**********************************************************
+ * mmap_realloc
+ * Resize the mapping of bp with mremap, or move the data
+ * back into the heap if size is below the threshold
+ **********************************************************/
+void* mmap_realloc(void* bp, size_t size) {
+    size_t old_len = GET_SIZE(HDRP(bp));
+    size_t offset = (char *)bp - MMAP_BASE(bp);
+    if (!use_mmap(size)) {
+        void* newptr = mm_malloc(size);
+        if (newptr == NULL)
             return NULL;
+        memcpy(newptr, bp, MIN(size, old_len - offset));
+        mmap_free(bp);
+        return newptr;
+    }
+    size_t len = mmap_length(offset, size);
+    if (len == old_len)
+        return bp;
+    char* m = mremap(MMAP_BASE(bp), old_len, len, MREMAP_MAYMOVE);
+    if (m == MAP_FAILED)
+        return NULL;
+    STAT_ADD(mmap_bytes, len - old_len);
+    PUT(m + offset - WSIZE - DSIZE, PACK(len, MMAPPED | 1));
+    return m + offset;
+}
+
+/**********************************************************
+ * pcpu_clear
+ * Empty the caches of every CPU, whose slots belong to the
+ * heap mm_init is about to lay out again
+ **********************************************************/
+void pcpu_clear(void) {
+    for (int cpu = 0; cpu < MM_MAX_CPUS; ++cpu)
+        for (int i = 0; i < PCPU_CLASSES; ++i)
+            if (pcpu[cpu].count[i] != 0)
+                pcpu[cpu].count[i] = 0;
+}
+
+#ifdef PCPU_RSEQ
+/**********************************************************
+ * rseq_area
+ * The rseq area of the calling thread, or NULL if the C
+ * library does not register one
+ **********************************************************/
+static inline char* rseq_area(void) {
+    if (&__rseq_size == NULL || __rseq_size == 0)
+        return NULL;
+    return (char *)__builtin_thread_pointer() + __rseq_offset;
+}
 
-        /* Jump over pointers */
-        newptr += DSIZE;
+#define MM_STR_(x)      #x
+#define MM_STR(x)       MM_STR_(x)
+
+/* The critical section from 1 up to 2, with its abort handler at 4 behind
+   the signature the kernel checks, restarts from 0. The section ends with
+   the store to count that commits it; an abort before then discards it */
+#define RSEQ_ENTER                                                      \
+    ".pushsection __rseq_cs, \"aw\"\n\t"                                \
+    ".balign 32\n"                                                      \
+    "3:\n\t"                                                            \
+    ".long 0, 0\n\t"                                                    \
+    ".quad 1f, (2f - 1f), 4f\n\t"                                       \
+    ".popsection\n"                                                     \
+    "0:\n\t"                                                            \
+    "leaq 3b(%%rip), %%rax\n\t"                                         \
+    "movq %%rax, 8(%[rs])\n"                                            \
+    "1:\n\t"
+
+#define RSEQ_LEAVE                                                      \
+    "2:\n\t"                                                            \
+    ".pushsection __rseq_failure, \"ax\"\n\t"                           \
+    ".byte 0x0f, 0xb9, 0x3d\n\t"                                        \
+    ".long " MM_STR(RSEQ_SIG) "\n"                                      \
+    "4:\n\t"                                                            \
+    "jmp 0b\n\t"                                                        \
+    ".popsection\n\t"
+
+/**********************************************************
+ * rseq_pop / rseq_push
+ * Take a slot of class idx from, or put p into, the cache of
+ * the CPU the thread runs on, as a restartable sequence on
+ * the rseq area rs. rseq_pop returns NULL if the class is
+ * empty and rseq_push 0 if it is full, as do both if the
+ * CPU has no cache
+ **********************************************************/
+static inline void* rseq_pop(char* rs, int idx) {
+    void* p;
+    __asm__ __volatile__(
+        RSEQ_ENTER
+        "xorl %k[p], %k[p]\n\t"
+        "movl 4(%[rs]), %%eax\n\t"              /* rseq cpu_id */
+        "cmpl %[ncpu], %%eax\n\t"
+        "jae 2f\n\t"
+        "imulq %[stride], %%rax, %%rax\n\t"
+        "movq (%[count], %%rax), %%rcx\n\t"
+        "testq %%rcx, %%rcx\n\t"
+        "jz 2f\n\t"
+        "leaq (%[slots], %%rax), %%rdx\n\t"
+        "movq -8(%%rdx, %%rcx, 8), %[p]\n\t"
+        "decq %%rcx\n\t"
+        "movq %%rcx, (%[count], %%rax)\n"
+        RSEQ_LEAVE
+        : [p] "=&r" (p)
+        : [rs] "r" (rs), [count] "r" (&pcpu[0].count[idx]),
+          [slots] "r" (&pcpu[0].slots[idx][0]),
+          [ncpu] "i" (MM_MAX_CPUS), [stride] "i" (sizeof(pcpu_cache_t))
+        : "rax", "rcx", "rdx", "memory", "cc");
+    return p;
+}
+
+static inline int rseq_push(char* rs, int idx, void* p) {
+    int done;
+    __asm__ __volatile__(
+        RSEQ_ENTER
+        "xorl %[done], %[done]\n\t"
+        "movl 4(%[rs]), %%eax\n\t"              /* rseq cpu_id */
+        "cmpl %[ncpu], %%eax\n\t"
+        "jae 2f\n\t"
+        "imulq %[stride], %%rax, %%rax\n\t"
+        "movq (%[count], %%rax), %%rcx\n\t"
+        "cmpq %[max], %%rcx\n\t"
+        "jae 2f\n\t"
+        "leaq (%[slots], %%rax), %%rdx\n\t"
+        "movq %[p], (%%rdx, %%rcx, 8)\n\t"
+        "incq %%rcx\n\t"
+        "movl $1, %[done]\n\t"
+        "movq %%rcx, (%[count], %%rax)\n"
+        RSEQ_LEAVE
+        : [done] "=&r" (done)
+        : [rs] "r" (rs), [p] "r" (p), [count] "r" (&pcpu[0].count[idx]),
+          [slots] "r" (&pcpu[0].slots[idx][0]), [max] "i" (PCPU_COUNT),
+          [ncpu] "i" (MM_MAX_CPUS), [stride] "i" (sizeof(pcpu_cache_t))
+        : "rax", "rcx", "rdx", "memory", "cc");
+    return done;
+}
+#endif
+
+/**********************************************************
+ * pcpu_lock
+ * Lock and return the cache of the CPU the thread runs on,
+ * or return NULL if it has none. Used without rseq only
+ **********************************************************/
+pcpu_cache_t* pcpu_lock(void) {
+    int cpu = sched_getcpu();
+    if (cpu < 0 || cpu >= MM_MAX_CPUS)
+        return NULL;
+    pthread_mutex_lock(&pcpu[cpu].lock);
+    return &pcpu[cpu];
+}
 
-        /* Initialize free block header/footer and the epilogue header */
-        PUT(HDRP(newptr), PACK(extendsize, 0));         // free block header
-        PUT(FTRP(newptr), PACK(extendsize, 0));         // free block footer
-        PUT(HDRP(NEXT_BLKP(newptr)), PACK(0, 1));       // new epilogue header
-        PUT(HDRP(ptr), PACK(asize, 1));
-        PUT(FTRP(ptr), PACK(GET_SIZE(last_blk_hd), 1));
+/**********************************************************
+ * pcpu_pop
+ * Take a slot of class idx from the cache of the current
+ * CPU. Returns NULL if there is none
+ **********************************************************/
+void* pcpu_pop(int idx) {
+    void* p = NULL;
+#ifdef PCPU_RSEQ
+    char* rs = rseq_area();
+    if (rs != NULL)
+        return rseq_pop(rs, idx);
+#endif
+    pcpu_cache_t* c = pcpu_lock();
+    if (c == NULL)
+        return NULL;
+    if (c->count[idx] != 0)
+        p = c->slots[idx][--c->count[idx]];
+    pthread_mutex_unlock(&c->lock);
+    return p;
+}
+
+/**********************************************************
+ * pcpu_push
+ * Put slot p into class idx of the cache of the current CPU.
+ * Returns 0 if there is no room for it
+ **********************************************************/
+int pcpu_push(int idx, void* p) {
+    int done = 0;
+#ifdef PCPU_RSEQ
+    char* rs = rseq_area();
+    if (rs != NULL)
+        return rseq_push(rs, idx, p);
+#endif
+    pcpu_cache_t* c = pcpu_lock();
+    if (c == NULL)
+        return 0;
+    if (c->count[idx] < PCPU_COUNT) {
+        c->slots[idx][c->count[idx]++] = p;
+        done = 1;
+    }
+    pthread_mutex_unlock(&c->lock);
+    return done;
+}
+
+/**********************************************************
+ * pcpu_lock_all / pcpu_unlock_all
+ * Take and release the lock of every cache, where they are
+ * used, for mm_lock_heap
+ **********************************************************/
+void pcpu_lock_all(void) {
+#ifdef PCPU_RSEQ
+    if (rseq_area() != NULL)
+        return;
+#endif
+    for (int cpu = 0; cpu < MM_MAX_CPUS; ++cpu)
+        pthread_mutex_lock(&pcpu[cpu].lock);
+}
+
+void pcpu_unlock_all(void) {
+#ifdef PCPU_RSEQ
+    if (rseq_area() != NULL)
+        return;
+#endif
+    for (int cpu = 0; cpu < MM_MAX_CPUS; ++cpu)
+        pthread_mutex_unlock(&pcpu[cpu].lock);
+}
+
+/**********************************************************
+ * pcpu_cached_bytes
+ * Bytes of the slab slots held by the CPU caches, for
+ * mm_stats. Under rseq the other CPUs keep going as the
+ * counts are read, so the sum is a snapshot; with the
+ * locks, the caller holds them all
+ **********************************************************/
+size_t pcpu_cached_bytes(void) {
+    size_t bytes = 0;
+    for (int cpu = 0; cpu < MM_MAX_CPUS; ++cpu) {
+        for (int i = 0; i < PCPU_CLASSES; ++i)
+            bytes += __atomic_load_n(&pcpu[cpu].count[i], __ATOMIC_RELAXED) *
+                     kListSizes[i];
+    }
+    return bytes;
+}
+
+/**********************************************************
+ * pcpu_free
+ * Cache the slab slot p of class idx. If the cache is full,
+ * free p and up to PCPU_BATCH of the cached slots back to
+ * their slabs under a single acquisition of the lock
+ **********************************************************/
+void pcpu_free(int idx, void* p) {
+    void* batch[PCPU_BATCH];
+    int n = 0;
+
+    if (pcpu_push(idx, p))
+        return;
+    while (n < PCPU_BATCH && (batch[n] = pcpu_pop(idx)) != NULL)
+        ++n;
+    pthread_mutex_lock(&heap_lock);
+    slab_free(p);
+    while (n > 0)
+        slab_free(batch[--n]);
+    pthread_mutex_unlock(&heap_lock);
+}
+
+/**********************************************************
+ * pcpu_refill
+ * Take a slot of class idx from the slabs, creating a slab
+ * if needed, and move up to PCPU_BATCH - 1 more free slots
+ * of the existing slabs into the cache; no slab is created
+ * for the cache. Returns NULL if no slab can be made
+ **********************************************************/
+void* pcpu_refill(int idx) {
+    void* batch[PCPU_BATCH];
+    int n = 0, i;
+
+    pthread_mutex_lock(&heap_lock);
+    if ((batch[0] = slab_alloc(idx)) != NULL)
+        for (n = 1; n < PCPU_BATCH && slab_partial[idx] != NULL; ++n)
+            batch[n] = slab_alloc(idx);
+    pthread_mutex_unlock(&heap_lock);
+
+    /* Whatever does not fit, should the thread have moved to a CPU with
+       a fuller cache, goes back */
+    for (i = 1; i < n && pcpu_push(idx, batch[i]); ++i)
+        ;
+    if (i < n) {
+        pthread_mutex_lock(&heap_lock);
+        for (; i < n; ++i)
+            slab_free(batch[i]);
+        pthread_mutex_unlock(&heap_lock);
+    }
+    return n != 0 ? batch[0] : NULL;
+}
+
+/**********************************************************
+ * mm_free
+ * Return a slab slot to the CPU cache, unmap a block with
+ * a mapping of its own, otherwise free the block into the
+ * segregated lists, or queue it with remote_free if another
+ * thread holds heap_lock
+ **********************************************************/
+void mm_free(void *bp)
+{
+    if (bp == NULL){
+      return;
+    }
+    if (is_slab_ptr(bp)) {
+        pcpu_free(get_size_class(SLAB_OF(bp)->slot_size), bp);
+        return;
+    }
+    if (GET_MMAPPED(HDRP(bp))) {
+        mmap_free(bp);
+        return;
+    }
+    if (pthread_mutex_trylock(&heap_lock) != 0) {
+        remote_free(&main_heap, bp);
+        return;
+    }
+    free_locked(bp);
+    pthread_mutex_unlock(&heap_lock);
+}
+
+/**********************************************************
+ * mm_free_sized
+ * mm_free for a block whose requested size is known. The
+ * size gives the slab class and tells a mapping from a heap
+ * block, so neither the slab nor the block header is read
+ * to find out.
+ **********************************************************/
+void mm_free_sized(void *bp, size_t size)
+{
+    if (bp == NULL){
+      return;
+    }
+    if (size <= SLAB_MAX_SIZE && is_slab_ptr(bp)) {
+        pcpu_free(get_size_class(size), bp);
+        return;
+    }
+    if (use_mmap(size)) {
+        mmap_free(bp);
+        return;
+    }
+    if (pthread_mutex_trylock(&heap_lock) != 0) {
+        remote_free(&main_heap, bp);
+        return;
+    }
+    free_locked(bp);
+    pthread_mutex_unlock(&heap_lock);
+}
+
+/**********************************************************
+ * mm_malloc
+ * Allocate a block of size bytes.
+ * Small requests are served from the CPU cache or a slab,
+ * large ones from a mapping of their own.
+ * The type of search is determined by find_fit
+ * The decision of splitting the block, or not is determined
+ *   in place(..)
+ * If no block satisfies the request, the heap is extended
+ **********************************************************/
+void *mm_malloc(size_t size)
+{
+    size_t asize; /* adjusted block size */
+    char * bp;
+
+    /* Ignore spurious requests */
+    if (size == 0 || size > MAX_REQUEST)
+        return NULL;
+
+    if (size <= SLAB_MAX_SIZE) {
+        int idx = get_size_class(size);
+        if ((bp = pcpu_pop(idx)) != NULL || (bp = pcpu_refill(idx)) != NULL)
+            return bp;
+    }
+
+    if (use_mmap(size))
+        return mmap_alloc(size);
+
+    asize = get_adjusted_size(size);
+    pthread_mutex_lock(&heap_lock);
+    if (DEBUG) {
+        mm_check();
+    } 
+    bp = malloc_locked(asize);
+    pthread_mutex_unlock(&heap_lock);
+    return bp;
+}
+
+/**********************************************************
+ * realloc_locked
+ * Resize the block in place when possible, otherwise move it
+ * to a new block. The caller holds heap_lock.
+ *********************************************************/
+void *realloc_locked(void *ptr, size_t size)
+{
+    void *newptr;
+    size_t cur_size;
+    size_t asize;
+
+    cur_size = GET_SIZE(HDRP(ptr));
+    asize = get_adjusted_size(size);  
+    /* If the desired size fits, keep the block. Only a large shrink gives
+       the tail back: the traces tend to grow the block again soon after. */
+    if (asize <= cur_size) {
+        if (cur_size - asize >= REALLOC_SHRINK_MIN)
+            split_tail(ptr, asize);
+        STAT_INC(realloc_in_place);
         return ptr;
     }
 
+    void* next = NEXT_BLKP(ptr);
+    size_t next_alloc = GET_ALLOC(HDRP(next));
+    size_t next_size = GET_SIZE(HDRP(next));
+    size_t prev_size = GET_PREV_ALLOC(HDRP(ptr)) ? 0 : GET_SIZE(HDRP(ptr) - WSIZE);
+
+    /* Check to see if there is room (free block) in front of the block */
+    if (!next_alloc && cur_size + next_size >= asize) {
+        /* Use the room since it is sufficient */
+        free_from_list(next);
+        mark_allocated(ptr, cur_size + next_size);
+        split_tail(ptr, asize);
+        STAT_INC(realloc_in_place);
+        return ptr; 
+    }
+
+    /* If the given block that you want to extend is at the end of the heap,
+       possibly followed by a free block too small to help, then grow the
+       heap by a step of grow_size for the shortfall, and give what the
+       block does not need back as a free block */
+    if (next_size == 0 || (!next_alloc && GET_SIZE(HDRP(NEXT_BLKP(next))) == 0)) {
+        size_t extendsize = grow_size(asize - cur_size - next_size);
+        if (heap_sbrk(extendsize) != (void *)-1) {
+            if (!next_alloc)
+                free_from_list(next);
+            /* Grow the block over the old epilogue and write the new one */
+            PUT(HDRP(ptr), PACK(cur_size + next_size + extendsize,
+                                GET_PREV_ALLOC(HDRP(ptr)) | 1));
+            PUT(HDRP(NEXT_BLKP(ptr)), PACK(0, PREV_ALLOC | 1));
+            split_tail(ptr, asize);
+            STAT_INC(realloc_in_place);
+            return ptr;
+        }
+    }
+
+    /* Grow backwards into a free previous block, taking the free next block
+       as well only if both are needed, and slide the data down */
+    if (prev_size != 0 && (prev_size + cur_size >= asize ||
+            (!next_alloc && prev_size + cur_size + next_size >= asize))) {
+        void* prev = PREV_BLKP(ptr);
+        size_t total = prev_size + cur_size;
+        free_from_list(prev);
+        if (total < asize) {
+            free_from_list(next);
+            total += next_size;
+        }
+        memmove(prev, ptr, cur_size - WSIZE - DSIZE);
+        mark_allocated(prev, total);
+        split_tail(prev, asize);
+        STAT_INC(realloc_in_place);
+        return prev;
+    }
+
     /* Find a new block for fit and copy over data */
-    newptr = mm_malloc(size);
+    newptr = malloc_locked(asize);
     if (newptr == NULL)
       return NULL;
 
-    /* Copy the old data. */
-    cur_size = GET_SIZE(HDRP(ptr));
+    /* Copy the old data: the payload, without the header and list
+       pointers that the block size counts as well */
+    cur_size = GET_SIZE(HDRP(ptr)) - WSIZE - DSIZE;
     if (size < cur_size)
         cur_size = size;
 
     memcpy(newptr, ptr, cur_size);
-    mm_free(ptr);
+    free_locked(ptr);
+    STAT_INC(realloc_moved);
     return newptr;
 }
 
+/**********************************************************
+ * mm_realloc
+ * Implemented in terms of realloc_locked, mm_malloc and
+ * mm_free
+ *********************************************************/
+void *mm_realloc(void *ptr, size_t size)
+{
+    /* If size == 0 then this is just free, and we return NULL. */
+    if (size == 0){
+        mm_free(ptr);
+        return NULL;
+    }
+    /* If ptr is NULL, then this is just malloc. */
+    if (ptr == NULL) {
+        return (mm_malloc(size));
+    }
+    if (size > MAX_REQUEST)
+        return NULL;
+    /* A slot keeps its data while the new size is of the same class, so
+       that the size alone gives the class to mm_free_sized */
+    if (is_slab_ptr(ptr)) {
+        size_t slot_size = SLAB_OF(ptr)->slot_size;
+        if (get_size_class(size) == get_size_class(slot_size))
+            return ptr;
+        void *newptr = mm_malloc(size);
+        if (newptr == NULL)
+            return NULL;
+        memcpy(newptr, ptr, MIN(size, slot_size));
+        mm_free(ptr);
+        return newptr;
+    }
+    if (GET_MMAPPED(HDRP(ptr)))
+        return mmap_realloc(ptr, size);
+    /* A heap block growing past the threshold moves to a mapping */
+    if (use_mmap(size)) {
+        void *newptr = mmap_alloc(size);
+        if (newptr == NULL)
+            return NULL;
+        memcpy(newptr, ptr, MIN(size, GET_SIZE(HDRP(ptr)) - WSIZE - DSIZE));
+        mm_free(ptr);
+        return newptr;
+    }
+    pthread_mutex_lock(&heap_lock);
+    void *newptr = realloc_locked(ptr, size);
+    pthread_mutex_unlock(&heap_lock);
+    return newptr;
+}
+
+/**********************************************************
+ * mm_memalign
+ * Allocate a block of size bytes aligned to align, which
+ * must be a power of two. Heap blocks are carved out of a
+ * free block with room for the aligned payload, and the
+ * leading fragment goes back to the segregated lists.
+ *********************************************************/
+void *mm_memalign(size_t align, size_t size)
+{
+    char *bp;
+
+    if (align == 0 || (align & (align - 1)) != 0)
+        return NULL;
+    if (align <= DSIZE)
+        return mm_malloc(size);
+    if (size == 0 || size > MAX_REQUEST || align > MAX_REQUEST)
+        return NULL;
+    if (use_mmap(size))
+        return mmap_alloc_aligned(size, align);
+
+    pthread_mutex_lock(&heap_lock);
+    if (DEBUG) {
+        mm_check();
+    }
+    bp = malloc_aligned_locked(get_adjusted_size(size), align);
+    pthread_mutex_unlock(&heap_lock);
+    return bp;
+}
+
+/**********************************************************
+ * mm_aligned_alloc
+ * C11 aligned_alloc: mm_memalign for a size that is a
+ * multiple of align
+ *********************************************************/
+void *mm_aligned_alloc(size_t align, size_t size)
+{
+    if (align == 0 || size % align != 0)
+        return NULL;
+    return mm_memalign(align, size);
+}
+
+/**********************************************************
+ * zero_bytes
+ * memset(p, 0, n) for a DSIZE aligned p. Large ranges are
+ * cleared with non-temporal stores where SSE2 is available
+ *********************************************************/
+void zero_bytes(char *p, size_t n)
+{
+#ifdef __SSE2__
+    if (n >= CALLOC_STREAM_MIN) {
+        __m128i zero = _mm_setzero_si128();
+        char *end = p + (n & ~(size_t)(4 * DSIZE - 1));
+        for (; p < end; p += 4 * DSIZE) {
+            _mm_stream_si128((__m128i *)p, zero);
+            _mm_stream_si128((__m128i *)(p + DSIZE), zero);
+            _mm_stream_si128((__m128i *)(p + 2 * DSIZE), zero);
+            _mm_stream_si128((__m128i *)(p + 3 * DSIZE), zero);
+        }
+        _mm_sfence();
+        n &= 4 * DSIZE - 1;
+    }
+#endif
+    memset(p, 0, n);
+}
+
+/**********************************************************
+ * mm_calloc
+ * Allocate a zeroed array of nmemb elements of size bytes.
+ * Mappings are zero already. So is the part of a heap block
+ * that the heap grew by while allocating it, if the backend
+ * hands out zeroed memory (MM_SBRK_ZEROED): only the rest of
+ * the payload is cleared.
+ *********************************************************/
+void *mm_calloc(size_t nmemb, size_t size)
+{
+    char *bp;
+
+    if (size != 0 && nmemb > SIZE_MAX / size)
+        return NULL;
+    size *= nmemb;
+    if (size == 0 || size > MAX_REQUEST)
+        return NULL;
+    if (size <= SLAB_MAX_SIZE || use_mmap(size)) {
+        /* A small request is served by a slab below any mmap_threshold */
+        if ((bp = mm_malloc(size)) != NULL &&
+            (is_slab_ptr(bp) || !GET_MMAPPED(HDRP(bp))))
+            memset(bp, 0, size);
+        return bp;
+    }
+
+    pthread_mutex_lock(&heap_lock);
+    char *old_brk = (char *)mem_heap_hi() + 1;
+    bp = malloc_locked(get_adjusted_size(size));
+    char *new_brk = (char *)mem_heap_hi() + 1;
+    pthread_mutex_unlock(&heap_lock);
+    if (bp == NULL)
+        return NULL;
+
+    /* The new heap area is untouched but for the list pointers at its
+       start and the footer of the free block at its end */
+    char *fresh_lo = old_brk + DSIZE;
+    char *fresh_hi = new_brk - 2 * DSIZE;
+    if (!MM_SBRK_ZEROED || fresh_lo >= fresh_hi ||
+        fresh_lo >= bp + size || fresh_hi <= bp) {
+        zero_bytes(bp, size);
+        return bp;
+    }
+    if (fresh_lo > bp)
+        zero_bytes(bp, fresh_lo - bp);
+    if (fresh_hi < bp + size)
+        memset(fresh_hi, 0, bp + size - fresh_hi);
+    return bp;
+}
+
+/**********************************************************
+ * mm_usable_size
+ * Number of bytes the caller may use at ptr, which covers
+ * the rounding of its request
+ *********************************************************/
+size_t mm_usable_size(void *ptr)
+{
+    if (ptr == NULL)
+        return 0;
+    if (is_slab_ptr(ptr))
+        return SLAB_OF(ptr)->slot_size;
+    if (GET_MMAPPED(HDRP(ptr)))
+        return GET_SIZE(HDRP(ptr)) - ((char *)ptr - MMAP_BASE(ptr));
+    return GET_SIZE(HDRP(ptr)) - WSIZE - DSIZE;
+}
+
+/**********************************************************
+ * mm_malloc_batch
+ * Allocate up to n blocks of size bytes into ptrs and return
+ * how many were allocated. Heap blocks are cut from a single
+ * block that fits all of them.
+ *********************************************************/
+size_t mm_malloc_batch(size_t size, size_t n, void **ptrs)
+{
+    size_t i = 0;
+    char *bp;
+
+    if (size == 0 || size > MAX_REQUEST)
+        return 0;
+
+    if (size <= SLAB_MAX_SIZE) {
+        int idx = get_size_class(size);
+        for (; i < n && (ptrs[i] = pcpu_pop(idx)) != NULL; ++i)
+            ;
+        pthread_mutex_lock(&heap_lock);
+        for (; i < n && (ptrs[i] = slab_alloc(idx)) != NULL; ++i)
+            ;
+        pthread_mutex_unlock(&heap_lock);
+    }
+    /* Also for n == 0: malloc_locked(0) would cut a block of no size */
+    if (i == n)
+        return i;
+
+    if (use_mmap(size)) {
+        for (; i < n && (ptrs[i] = mmap_alloc(size)) != NULL; ++i)
+            ;
+        return i;
+    }
+
+    size_t asize = get_adjusted_size(size);
+    pthread_mutex_lock(&heap_lock);
+    if (n - i <= SIZE_MAX / asize && (bp = malloc_locked(asize * (n - i))) != NULL) {
+        /* The last block keeps what is too small to split off */
+        size_t rest = GET_SIZE(HDRP(bp));
+        size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+        for (; i < n; ++i) {
+            size_t bsize = i == n - 1 ? rest : asize;
+            PUT(HDRP(bp), PACK(bsize, prev_alloc | 1));
+            PUT_PTR(GET_PREV(bp), NULL);
+            PUT_PTR(GET_NEXT(bp), NULL);
+            ptrs[i] = bp;
+            rest -= bsize;
+            bp += bsize;
+            prev_alloc = PREV_ALLOC;
+        }
+    }
+    for (; i < n && (ptrs[i] = malloc_locked(asize)) != NULL; ++i)
+        ;
+    pthread_mutex_unlock(&heap_lock);
+    return i;
+}
+
+/**********************************************************
+ * compare_addresses
+ * qsort order of an array of block pointers by address
+ *********************************************************/
+int compare_addresses(const void *a, const void *b)
+{
+    uintptr_t x = (uintptr_t)*(void * const *)a;
+    uintptr_t y = (uintptr_t)*(void * const *)b;
+    return (x > y) - (x < y);
+}
+
+/**********************************************************
+ * mm_free_batch
+ * Free the n blocks of ptrs, NULL entries included, under
+ * one hold of heap_lock. Heap blocks are sorted by address
+ * (reordering ptrs), and each run of adjacent blocks merges
+ * into one block before it is freed.
+ *********************************************************/
+void mm_free_batch(void **ptrs, size_t n)
+{
+    size_t i, m = 0;
+
+    /* Mappings go right away, the rest stays at the front of ptrs */
+    for (i = 0; i < n; ++i) {
+        if (ptrs[i] == NULL)
+            continue;
+        if (!is_slab_ptr(ptrs[i]) && GET_MMAPPED(HDRP(ptrs[i])))
+            mmap_free(ptrs[i]);
+        else
+            ptrs[m++] = ptrs[i];
+    }
+
+    pthread_mutex_lock(&heap_lock);
+    n = m;
+    for (i = 0, m = 0; i < n; ++i) {
+        if (is_slab_ptr(ptrs[i]))
+            slab_free(ptrs[i]);
+        else
+            ptrs[m++] = ptrs[i];
+    }
+    qsort(ptrs, m, sizeof(void *), compare_addresses);
+    for (i = 0; i < m; ) {
+        char *bp = ptrs[i];
+        size_t size = GET_SIZE(HDRP(bp));
+        for (++i; i < m && (char *)ptrs[i] == bp + size; ++i)
+            size += GET_SIZE(HDRP(ptrs[i]));
+        PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp)) | 1));
+        free_locked(bp);
+    }
+    pthread_mutex_unlock(&heap_lock);
+}
+
+/**********************************************************
+ * mm_arena_create
+ * Map a region of size bytes (MM_ARENA_SIZE if 0) for a new
+ * arena, which sits at its start. Pages are only backed as
+ * the heap of the arena grows into them
+ *********************************************************/
+mm_arena_t *mm_arena_create(size_t size)
+{
+    mm_arena_t *a;
+    int result;
+
+    if (size == 0)
+        size = MM_ARENA_SIZE;
+    if (size < ARENA_HDR_SIZE)
+        return NULL;
+    a = mmap(NULL, size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (a == MAP_FAILED)
+        return NULL;
+    pthread_mutex_init(&a->lock, NULL);
+    a->owner = pthread_self();
+    a->size = size;
+    a->heap.lo = a->heap.brk = (char *)a + ARENA_HDR_SIZE;
+    a->heap.end = (char *)a + size;
+
+    heap = &a->heap;
+    result = heap_init();
+    heap = &main_heap;
+    if (result != 0) {
+        munmap(a, size);
+        return NULL;
+    }
+    return a;
+}
+
+/**********************************************************
+ * mm_arena_malloc
+ * mm_malloc within arena a: every block comes from the
+ * segregated lists of the arena, or from growing its heap
+ *********************************************************/
+void *mm_arena_malloc(mm_arena_t *a, size_t size)
+{
+    void *bp;
+
+    if (size == 0 || size > MAX_REQUEST)
+        return NULL;
+    pthread_mutex_lock(&a->lock);
+    heap = &a->heap;
+    if (DEBUG) {
+        mm_check();
+    }
+    bp = malloc_locked(get_adjusted_size(size));
+    heap = &main_heap;
+    pthread_mutex_unlock(&a->lock);
+    return bp;
+}
+
+/**********************************************************
+ * mm_arena_free
+ * Free a block of arena a into the lists of the arena. Other
+ * threads than its owner only queue the block, which the
+ * next allocation from the arena frees
+ *********************************************************/
+void mm_arena_free(mm_arena_t *a, void *ptr)
+{
+    if (ptr == NULL)
+        return;
+    if (!pthread_equal(pthread_self(), a->owner)) {
+        remote_free(&a->heap, ptr);
+        return;
+    }
+    pthread_mutex_lock(&a->lock);
+    heap = &a->heap;
+    free_locked(ptr);
+    heap = &main_heap;
+    pthread_mutex_unlock(&a->lock);
+}
+
+/**********************************************************
+ * mm_arena_reset
+ * Free every block of arena a at once. The pages of the
+ * arena stay mapped for the blocks that follow
+ *********************************************************/
+void mm_arena_reset(mm_arena_t *a)
+{
+    pthread_mutex_lock(&a->lock);
+    heap = &a->heap;
+    heap->brk = heap->lo;
+    heap_init();
+    heap = &main_heap;
+    pthread_mutex_unlock(&a->lock);
+}
+
+/**********************************************************
+ * mm_arena_destroy
+ * Unmap arena a with all its blocks
+ *********************************************************/
+void mm_arena_destroy(mm_arena_t *a)
+{
+    if (a == NULL)
+        return;
+    pthread_mutex_destroy(&a->lock);
+    munmap(a, a->size);
+}
+
+/**********************************************************
+ * mm_trim
+ * Shrink the heap past its free top block, keeping pad
+ * bytes of it, and drop the pages inside every other free
+ * block. Returns 1 if any memory was released
+ *********************************************************/
+int mm_trim(size_t pad)
+{
+    int released = 0;
+    pthread_mutex_lock(&heap_lock);
+    remote_drain();
+    quick_consolidate();
+    for (int i = 0; i < NUM_LISTS; ++i) {
+        for (uintptr_t* cur = GET_PTR(LIST_HEAD(i)); cur != NULL;
+             cur = GET_PTR(GET_NEXT(cur))) {
+            if (GET_SIZE(HDRP(NEXT_BLKP(cur))) != 0)
+                released |= release_pages(cur);
+        }
+    }
+    released |= trim_top(pad);
+    pthread_mutex_unlock(&heap_lock);
+    return released;
+}
+
+/**********************************************************
+ * mm_lock_heap / mm_unlock_heap
+ * Take and release heap_lock, and the locks of the CPU
+ * caches, on behalf of the caller, such as fork handlers
+ *********************************************************/
+void mm_lock_heap(void)
+{
+    pcpu_lock_all();
+    pthread_mutex_lock(&heap_lock);
+}
+
+void mm_unlock_heap(void)
+{
+    pthread_mutex_unlock(&heap_lock);
+    pcpu_unlock_all();
+}
+
+/**********************************************************
+ * mm_stats
+ * Fill st with the event counters and a census of the free
+ * blocks, taken under mm_lock_heap. Slots in the CPU caches
+ * and blocks queued by remote_free count as free bytes,
+ * though not in the per-class census
+ *********************************************************/
+void mm_stats(mm_stats_t *st)
+{
+    size_t free_bytes;
+    mm_lock_heap();
+    free_bytes = pcpu_cached_bytes();
+    *st = main_heap.counters;
+    st->mmap_bytes = __atomic_load_n(&main_heap.counters.mmap_bytes, __ATOMIC_RELAXED);
+    for (int i = 0; i < NUM_LISTS + QUICK_BINS; ++i) {
+        uintptr_t* cur = i < NUM_LISTS ? GET_PTR(LIST_HEAD(i)) : heap->quick_head[i - NUM_LISTS];
+        for (; cur != NULL; cur = GET_PTR(GET_NEXT(cur))) {
+            size_t size = GET_SIZE(HDRP(cur));
+            int c = get_size_class(size);
+            st->free_blocks[c]++;
+            st->free_class_bytes[c] += size;
+            free_bytes += size;
+        }
+    }
+    for (int i = 0; i < SLAB_CLASSES; ++i) {
+        for (slab_t* s = slab_partial[i]; s != NULL; s = s->next)
+            free_bytes += (size_t)s->nfree * s->slot_size;
+    }
+    /* Only remote_drain, under heap_lock, takes blocks off the queue */
+    for (uintptr_t* cur = __atomic_load_n(&main_heap.remote, __ATOMIC_ACQUIRE);
+         cur != NULL; cur = GET_PTR(cur))
+        free_bytes += GET_SIZE(HDRP(cur));
+    st->heap_bytes = mem_heapsize();
+    st->free_bytes = free_bytes;
+    st->in_use_bytes = st->heap_bytes + st->mmap_bytes - free_bytes;
+    mm_unlock_heap();
+}
+
+/**********************************************************
+ * mm_stats_print
+ * Write st to out as text, or as a JSON object if json is
+ * set
+ *********************************************************/
+void mm_stats_print(FILE *out, const mm_stats_t *st, int json)
+{
+    const char* fmt = json ? "{\"heap_bytes\": %zu, \"mmap_bytes\": %zu, "
+                             "\"in_use_bytes\": %zu, \"free_bytes\": %zu,\n"
+                           : "heap %zu bytes, mapped %zu, in use %zu, free %zu\n";
+    fprintf(out, fmt, st->heap_bytes, st->mmap_bytes, st->in_use_bytes,
+            st->free_bytes);
+    fprintf(out, json ? " \"classes\": [" : "class      size    blocks     bytes\n");
+    for (int i = 0; i < MM_STATS_CLASSES; ++i) {
+        if (json)
+            fprintf(out, "%s{\"size\": %u, \"blocks\": %zu, \"bytes\": %zu}",
+                    i ? ", " : "", (unsigned)kListSizes[i], st->free_blocks[i],
+                    st->free_class_bytes[i]);
+        else if (st->free_blocks[i] != 0)
+            fprintf(out, "%5d %9u %9zu %9zu\n", i, (unsigned)kListSizes[i],
+                    st->free_blocks[i], st->free_class_bytes[i]);
+    }
+    fmt = json ? "],\n \"splits\": %lu, \"coalesces\": [%lu, %lu, %lu, %lu], "
+                 "\"extend_heap_calls\": %lu, \"quick_hits\": %lu,\n "
+                 "\"realloc_in_place\": %lu, \"realloc_moved\": %lu, "
+                 "\"fit_searches\": %lu, \"fit_steps\": %lu}\n"
+               : "splits %lu, coalesces %lu/%lu/%lu/%lu, extend_heap %lu, "
+                 "quick hits %lu\nrealloc in place %lu, moved %lu, "
+                 "fit searches %lu, steps %lu\n";
+    fprintf(out, fmt, st->splits, st->coalesces[0], st->coalesces[1],
+            st->coalesces[2], st->coalesces[3], st->extend_heap_calls,
+            st->quick_hits, st->realloc_in_place, st->realloc_moved,
+            st->fit_searches, st->fit_steps);
+}
+
 /**********************************************************
  * check_implicitly
  * Check the correctness of the heap with a linear traversal
@@ -530,22 +2476,31 @@ void *mm_realloc(void *ptr, size_t size)
  *    then a linear traveral would not arrive at the end of
  *    the heap
  * 2. Do all blocks have valid pointers? (NULL or between
- *    mem_heap_lo() and mem_heap_hi()
+ *    the start and the end of the heap)
+ * 3. Does every free block have a footer matching its
+ *    header, and every PREV_ALLOC bit match the block
+ *    before it?
  **********************************************************/
 int check_implicitly(void) {
-    void* bp = mem_heap_lo() + WSIZE * kLength + DSIZE + DSIZE;
+    char* bp = heap->lo + WSIZE * NUM_LISTS + DSIZE + DSIZE;
     for (; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
         void* next = GET_PTR(GET_NEXT(bp));
         void* prev = GET_PTR(GET_PREV(bp));
-        if (next != NULL && (next <= mem_heap_lo() || next >= mem_heap_hi())) {
+        if (next != NULL && (next <= (void *)heap->lo || next >= (void *)heap_hi())) {
             printf("Error: Invalid next pointer at %p\n", next);
             return 0;
-        } else if (prev != NULL && (prev <= mem_heap_lo() || prev >= mem_heap_hi())) {
+        } else if (prev != NULL && (prev <= (void *)heap->lo || prev >= (void *)heap_hi())) {
             printf("Error: Invalid prev pointer at %p\n", prev);
             return 0;
+        } else if (!GET_ALLOC(HDRP(bp)) && GET(FTRP(bp)) != GET_SIZE(HDRP(bp))) {
+            printf("Error: Footer of free block %p does not match its header\n", bp);
+            return 0;
+        } else if (!GET_PREV_ALLOC(HDRP(NEXT_BLKP(bp))) != !GET_ALLOC(HDRP(bp))) {
+            printf("Error: PREV_ALLOC bit after block %p is wrong\n", bp);
+            return 0;
         }
     }
-    if (bp - DSIZE != mem_heap_hi() + 1) {
+    if (bp - DSIZE != heap_hi() + 1) {
         printf("Error: Linear traversal of blocks ended before the end of heap\n");
         return 0;
     }
@@ -558,13 +2513,17 @@ int check_implicitly(void) {
  * 1. is every block in the sll actually free?
  * 2. does this free block belong to this list?
  * 3. are there any free blocks not coalesced properly?
+ * 4. does list_bitmap agree with the non-empty lists?
  *********************************************************/
 int check_explicitly(){
     int i;
-    int prev = 0;
     size_t size;
-    for (i = 0; i < kLength; ++i) {
-        uintptr_t* cur = GET_PTR((uintptr_t *)mem_heap_lo() + i);
+    for (i = 0; i < NUM_LISTS; ++i) {
+        uintptr_t* cur = GET_PTR(LIST_HEAD(i));
+        if ((cur != NULL) != list_is_marked(i)) {
+            printf("Error: Bitmap bit of SLL %d does not match the list.\n", i);
+            return 0;
+        }
         while(cur != NULL) {
             if (GET_ALLOC(HDRP(cur))) {
                 printf("Error: Block %p is allocated but found in the SLL.\n",
@@ -572,18 +2531,26 @@ int check_explicitly(){
                 return 0;
             }
             size = GET_SIZE(HDRP(cur));
-            if (size > kListSizes[i] || size <= prev) {
+            if (get_appropriate_list(size) != i) {
                 printf("Error: Block %p of size %lu is incorrectly put into SLL %d\n",
-                       cur, size, kListSizes[i]);
+                       cur, size, i);
                 return 0;
             }  
-            if (!GET_ALLOC(HDRP(PREV_BLKP(cur))) || !GET_ALLOC(HDRP(NEXT_BLKP(cur)))) {
+            if (!GET_PREV_ALLOC(HDRP(cur)) || !GET_ALLOC(HDRP(NEXT_BLKP(cur)))) {
                 printf("Error: Block %p was not properly coalesced.\n", cur);
                 return 0;
             }
             cur = GET_PTR(GET_NEXT(cur));
         }
-        prev = kListSizes[i];
+    }
+    for (i = 0; i < QUICK_BINS; ++i) {
+        for (uintptr_t* cur = heap->quick_head[i]; cur != NULL;
+             cur = GET_PTR(GET_NEXT(cur))) {
+            if (!GET_ALLOC(HDRP(cur)) || QUICK_INDEX(GET_SIZE(HDRP(cur))) != i) {
+                printf("Error: Block %p does not belong in quick list %d\n", cur, i);
+                return 0;
+            }
+        }
     }
     return 1;
 }
@@ -595,5 +2562,5 @@ int check_explicitly(){
  * Return nonzero if the heap is consistant.
  *********************************************************/
 int mm_check() {
-	return check_explicitly() || check_implicitly();
+	return check_explicitly() && check_implicitly();
 }
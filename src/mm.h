@@ -3,10 +3,132 @@
  * The public interface to the students' memory allocator.
  */
 
+#include <stdio.h>
+
 int mm_init(void);
 void *mm_malloc(size_t size);
 void mm_free(void *ptr);
 void *mm_realloc(void *ptr, size_t size);
+void *mm_calloc(size_t nmemb, size_t size);
+
+/*
+ * mm_free for callers that know the size ptr was last allocated or
+ * reallocated with, which must be passed as size. mm_usable_size returns
+ * how many bytes at ptr may be used, at least the size asked for.
+ */
+void mm_free_sized(void *ptr, size_t size);
+size_t mm_usable_size(void *ptr);
+
+/*
+ * Allocate size bytes aligned to align, a power of two; mm_aligned_alloc
+ * also requires size to be a multiple of align. The blocks are freed with
+ * mm_free as usual.
+ */
+void *mm_memalign(size_t align, size_t size);
+void *mm_aligned_alloc(size_t align, size_t size);
+
+/*
+ * Tunable allocator options. mm_init() starts the heap with the defaults
+ * filled in by mm_default_options(); mm_init_options() with the given ones.
+ */
+typedef struct {
+    size_t mmap_threshold;  /* Requests of at least this many bytes get a
+                               mapping of their own; 0 disables this */
+    size_t trim_threshold;  /* Free blocks of at least this many bytes go
+                               back to the OS as they are freed; 0 disables
+                               this */
+    size_t grow_min;        /* The heap grows by at least this many bytes */
+    unsigned grow_percent;  /* or this percentage of its size if more, */
+    size_t grow_max;        /* up to this many bytes, or by what a request
+                               needs if that is more. The rest of a growth
+                               step stays free */
+    unsigned fit_policy;    /* How a free block is picked, MM_FIT_* */
+    size_t fit_tries;       /* Blocks MM_FIT_BEST_K looks at */
+} mm_options_t;
+
+/*
+ * Fit policies. Each starts at the size class of the request:
+ * MM_FIT_HEAD    the head of the first non-empty class that may fit, else of
+ *                one that surely does; the fastest
+ * MM_FIT_FIRST   the first block that fits, searching the class in order
+ * MM_FIT_BEST_K  the smallest that fits of up to fit_tries blocks
+ * MM_FIT_BEST    the smallest block that fits; the tightest
+ * The -DMM_TLSF engine always takes a good fit and ignores the policy.
+ */
+#define MM_FIT_HEAD     0
+#define MM_FIT_FIRST    1
+#define MM_FIT_BEST_K   2
+#define MM_FIT_BEST     3
+
+void mm_default_options(mm_options_t *opts);
+int mm_init_options(const mm_options_t *opts);
+
+/*
+ * Allocate up to n blocks of size bytes into ptrs, returning how many were
+ * allocated, and free n blocks at once. mm_free_batch reorders ptrs.
+ */
+size_t mm_malloc_batch(size_t size, size_t n, void **ptrs);
+void mm_free_batch(void **ptrs, size_t n);
+
+/*
+ * Arenas: heaps of their own, each in a mapping of size bytes (a default
+ * of 1 GiB of address space if 0). Their blocks are freed with
+ * mm_arena_free, or all at once by mm_arena_reset or mm_arena_destroy.
+ * mm_arena_free called by another thread than the one that created the
+ * arena does not lock it: the block is queued, and reused once the arena
+ * allocates again.
+ */
+typedef struct mm_arena mm_arena_t;
+
+mm_arena_t *mm_arena_create(size_t size);
+void *mm_arena_malloc(mm_arena_t *arena, size_t size);
+void mm_arena_free(mm_arena_t *arena, void *ptr);
+void mm_arena_reset(mm_arena_t *arena);
+void mm_arena_destroy(mm_arena_t *arena);
+
+/*
+ * Return free memory to the OS: shrink the heap past its free top block,
+ * keeping pad bytes of it, and release the pages inside every other free
+ * block. Returns 1 if any memory was released.
+ */
+int mm_trim(size_t pad);
+
+/*
+ * Hold off every other thread's use of the heap until mm_unlock_heap(),
+ * e.g. around fork() so that the child gets the heap in a consistent state.
+ */
+void mm_lock_heap(void);
+void mm_unlock_heap(void);
+
+/*
+ * Allocator statistics. mm_stats() counts the free blocks per kListSizes
+ * class on the spot; the event counters are kept as the allocator runs, for
+ * the main heap only, and read zero when mm.c is built with -DMM_NO_STATS.
+ * mm_stats_print() writes them as text, or as a JSON object if json is set.
+ */
+#define MM_STATS_CLASSES 22
+
+typedef struct {
+    size_t heap_bytes;          /* mem_heapsize() */
+    size_t mmap_bytes;          /* in mappings of their own */
+    size_t in_use_bytes;        /* heap and mappings less free_bytes */
+    size_t free_bytes;          /* free blocks and slab slots, also those
+                                   cached per CPU or queued by frees from
+                                   other threads */
+    size_t free_blocks[MM_STATS_CLASSES];
+    size_t free_class_bytes[MM_STATS_CLASSES];
+    unsigned long splits;               /* blocks split in two */
+    unsigned long coalesces[4];         /* per case of coalesce() */
+    unsigned long extend_heap_calls;
+    unsigned long quick_hits;           /* mallocs served by a quick list */
+    unsigned long realloc_in_place;
+    unsigned long realloc_moved;
+    unsigned long fit_searches;         /* find_fit() calls */
+    unsigned long fit_steps;            /* free blocks looked at */
+} mm_stats_t;
+
+void mm_stats(mm_stats_t *st);
+void mm_stats_print(FILE *out, const mm_stats_t *st, int json);
 
 /* 
  * Students work in teams of one or two.  Teams enter their team name, personal
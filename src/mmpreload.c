@@ -0,0 +1,167 @@
+/*
+ * mmpreload.c: the standard malloc family on top of mm.c, built into
+ * libmm.so with the memmap.c backend ("make libmm.so"):
+ *
+ *     unix> LD_PRELOAD=./libmm.so ./service
+ *
+ * The first call sets up the heap, and may come from the dynamic loader
+ * or from libc before main runs: neither memmap.c nor mm_init allocate, so
+ * this does not recurse. libmm.so exports only the functions below, so the
+ * helpers of mm.c cannot clash with symbols of the program.
+ *
+ * Unlike mm_malloc, malloc(0) returns a block of its own, and failures set
+ * errno to ENOMEM as they do in glibc.
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define EXPORT __attribute__((visibility("default")))
+
+/* 1 once the heap is set up, -1 if that failed */
+static int heap_state;
+static pthread_once_t heap_once = PTHREAD_ONCE_INIT;
+
+static void heap_init(void)
+{
+    mem_init();
+    __atomic_store_n(&heap_state, mm_init() == 0 ? 1 : -1, __ATOMIC_RELEASE);
+}
+
+/**********************************************************
+ * heap_ready
+ * Set up the heap on the first call. Returns nonzero if it
+ * can be used; otherwise errno is ENOMEM
+ **********************************************************/
+static int heap_ready(void)
+{
+    int state = __atomic_load_n(&heap_state, __ATOMIC_ACQUIRE);
+    if (__builtin_expect(state == 0, 0)) {
+        pthread_once(&heap_once, heap_init);
+        state = __atomic_load_n(&heap_state, __ATOMIC_ACQUIRE);
+    }
+    if (state < 0)
+        errno = ENOMEM;
+    return state > 0;
+}
+
+/**********************************************************
+ * enomem
+ * Return p, setting errno to ENOMEM if it is NULL
+ **********************************************************/
+static void *enomem(void *p)
+{
+    if (p == NULL)
+        errno = ENOMEM;
+    return p;
+}
+
+/**********************************************************
+ * is_power_of_two
+ **********************************************************/
+static int is_power_of_two(size_t n)
+{
+    return n != 0 && (n & (n - 1)) == 0;
+}
+
+/* The heap lock is held across fork(), so the child gets the heap in a
+   consistent state */
+__attribute__((constructor))
+static void register_fork_handlers(void)
+{
+    pthread_atfork(mm_lock_heap, mm_unlock_heap, mm_unlock_heap);
+}
+
+EXPORT void *malloc(size_t size)
+{
+    if (!heap_ready())
+        return NULL;
+    return enomem(mm_malloc(size != 0 ? size : 1));
+}
+
+EXPORT void free(void *ptr)
+{
+    if (ptr != NULL)
+        mm_free(ptr);
+}
+
+EXPORT void *realloc(void *ptr, size_t size)
+{
+    if (ptr == NULL)
+        return malloc(size);
+    if (size == 0) {
+        mm_free(ptr);
+        return NULL;
+    }
+    return enomem(mm_realloc(ptr, size));
+}
+
+EXPORT void *calloc(size_t nmemb, size_t size)
+{
+    if (!heap_ready())
+        return NULL;
+    if (size != 0 && nmemb > SIZE_MAX / size)
+        return enomem(NULL);
+    if (nmemb == 0 || size == 0)
+        nmemb = size = 1;
+    return enomem(mm_calloc(nmemb, size));
+}
+
+EXPORT void *memalign(size_t align, size_t size)
+{
+    if (!heap_ready())
+        return NULL;
+    /* Like glibc, round an alignment that is not a power of two up */
+    while (!is_power_of_two(align))
+        align = align == 0 ? 1 : (align | (align - 1)) + 1;
+    return enomem(mm_memalign(align, size != 0 ? size : 1));
+}
+
+EXPORT int posix_memalign(void **memptr, size_t align, size_t size)
+{
+    void *p;
+    if (!is_power_of_two(align) || align % sizeof(void *) != 0)
+        return EINVAL;
+    if (!heap_ready())
+        return ENOMEM;
+    if ((p = mm_memalign(align, size != 0 ? size : 1)) == NULL)
+        return ENOMEM;
+    *memptr = p;
+    return 0;
+}
+
+EXPORT void *aligned_alloc(size_t align, size_t size)
+{
+    /* glibc accepts any size, not only multiples of align */
+    if (!is_power_of_two(align)) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return memalign(align, size);
+}
+
+EXPORT void *valloc(size_t size)
+{
+    return memalign(getpagesize(), size);
+}
+
+EXPORT void *pvalloc(size_t size)
+{
+    size_t page = getpagesize();
+    if (size > SIZE_MAX - page)
+        return enomem(NULL);
+    return memalign(page, (size + page - 1) & ~(page - 1));
+}
+
+EXPORT size_t malloc_usable_size(void *ptr)
+{
+    return mm_usable_size(ptr);
+}
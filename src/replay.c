@@ -0,0 +1,771 @@
+/*
+ * replay: a source-level trace replay benchmark for mm.c.
+ *
+ * It reads the same .rep traces as mdriver:
+ *     <suggested heap size>
+ *     <number of ids>
+ *     <number of ops>
+ *     <weight>
+ *     a <id> <size>     allocate
+ *     r <id> <size>     reallocate
+ *     f <id>            free
+ * and replays each one on a fresh heap, timing every operation with the
+ * cycle counter (rdtsc on x86, nanoseconds elsewhere). The samples go into
+ * a log-linear histogram per kind of operation, in the manner of an HDR
+ * histogram, from which the tail percentiles are reported. Like mdriver it
+ * also reports the peak utilization: the largest amount of live payload
+ * over the largest heap.
+ *
+ * Samples include the overhead of reading the counter.
+ *
+ * With -m, the traces are replayed on several threads sharing one heap
+ * instead, and the throughput is reported for 1, 2, 4, ... threads up to
+ * -T (the number of CPUs by default):
+ *     copies   every thread replays its own copy of the trace
+ *     shards   thread k replays the ops on the ids that are k modulo the
+ *              number of threads
+ *     handoff  threads work in pairs: the producer replays the allocations
+ *              and reallocations, and passes every block the trace frees
+ *              to the consumer, which frees it
+ * With -c, every thread allocates with mm_calloc and checks that the block
+ * is zeroed, fills the blocks it gets with a pattern of its own and checks
+ * it before each realloc and free, and the heap is checked
+ * with mm_check() after every run; replay exits on the first error. This
+ * makes the thread modes a stress test of the allocator.
+ *
+ * With -p, the heap runs with the given fit policy of mm_options_t, or with
+ * each of them in turn for "all"; on one thread, the report is then the
+ * peak utilization and the throughput of every trace under every policy.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "mm.h"
+#include "memlib.h"
+
+#define DEFAULT_TRACEDIR "../testcases/"
+
+enum { OP_ALLOC, OP_FREE, OP_REALLOC, OP_KINDS };
+
+static const char *kOpNames[OP_KINDS] = { "malloc", "free", "realloc" };
+
+/* Indexed by the MM_FIT_* policies */
+static const char *kFitNames[] = { "head", "first", "best-k", "best" };
+
+#define FIT_POLICIES    4
+
+/* Options every replay starts the heap with */
+static mm_options_t heap_options;
+
+/* Set by -c: check the blocks and the heap of the thread modes */
+static int verify;
+
+/* Not declared by mm.h */
+int mm_check();
+
+typedef struct {
+    int type;
+    int id;
+    size_t size;
+} op_t;
+
+typedef struct {
+    char name[256];
+    int num_ids;
+    int num_ops;
+    op_t *ops;
+} trace_t;
+
+/*************************************************************************
+ * Histograms
+ * Values below 2^HIST_SUB_BITS have a bucket each; above, every power of
+ * two is cut into 2^HIST_SUB_BITS buckets, so a bucket is within 1/32 of
+ * the values it holds.
+*************************************************************************/
+#define HIST_SUB_BITS   5
+#define HIST_SUB        (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS    ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+typedef struct {
+    uint64_t count;
+    uint64_t max;
+    uint64_t buckets[HIST_BUCKETS];
+} hist_t;
+
+/**********************************************************
+ * hist_index / hist_value
+ * Bucket of value v, and the highest value of bucket i
+ **********************************************************/
+static int hist_index(uint64_t v)
+{
+    if (v < HIST_SUB)
+        return (int)v;
+    int e = 63 - __builtin_clzll(v);
+    return (e - HIST_SUB_BITS + 1) * HIST_SUB +
+           (int)(v >> (e - HIST_SUB_BITS)) - HIST_SUB;
+}
+
+static uint64_t hist_value(int i)
+{
+    if (i < HIST_SUB)
+        return i;
+    int k = i / HIST_SUB;
+    uint64_t m = i % HIST_SUB + HIST_SUB;
+    return ((m + 1) << (k - 1)) - 1;
+}
+
+static void hist_add(hist_t *h, uint64_t v)
+{
+    h->buckets[hist_index(v)]++;
+    h->count++;
+    if (v > h->max)
+        h->max = v;
+}
+
+static void hist_merge(hist_t *to, const hist_t *from)
+{
+    for (int i = 0; i < HIST_BUCKETS; ++i)
+        to->buckets[i] += from->buckets[i];
+    to->count += from->count;
+    if (from->max > to->max)
+        to->max = from->max;
+}
+
+/**********************************************************
+ * hist_percentile
+ * Smallest bucket value that at least q of the samples do
+ * not exceed
+ **********************************************************/
+static uint64_t hist_percentile(const hist_t *h, double q)
+{
+    uint64_t rank = (uint64_t)(q * h->count + 0.5);
+    uint64_t seen = 0;
+    if (rank == 0)
+        rank = 1;
+    for (int i = 0; i < HIST_BUCKETS; ++i) {
+        seen += h->buckets[i];
+        if (seen >= rank)
+            return hist_value(i) < h->max ? hist_value(i) : h->max;
+    }
+    return h->max;
+}
+
+/**********************************************************
+ * now
+ * The cycle counter, or a nanosecond clock without one
+ **********************************************************/
+static inline uint64_t now(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+/**********************************************************
+ * read_trace
+ * Load a .rep file into memory. Returns 0 on success
+ **********************************************************/
+static int read_trace(const char *path, trace_t *t)
+{
+    FILE *f = fopen(path, "r");
+    char type[2];
+    int weight, i;
+    long heap_size;
+
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+    const char *base = strrchr(path, '/');
+    snprintf(t->name, sizeof(t->name), "%s", base ? base + 1 : path);
+    if (fscanf(f, "%ld %d %d %d", &heap_size, &t->num_ids, &t->num_ops,
+               &weight) != 4 || t->num_ids < 0 || t->num_ops < 0) {
+        fprintf(stderr, "%s: bad trace header\n", path);
+        fclose(f);
+        return -1;
+    }
+    t->ops = calloc(t->num_ops ? t->num_ops : 1, sizeof(op_t));
+    for (i = 0; i < t->num_ops; ++i) {
+        op_t *op = &t->ops[i];
+        if (fscanf(f, "%1s %d", type, &op->id) != 2)
+            break;
+        if (type[0] == 'f') {
+            op->type = OP_FREE;
+        } else {
+            op->type = type[0] == 'a' ? OP_ALLOC : OP_REALLOC;
+            if ((type[0] != 'a' && type[0] != 'r') ||
+                fscanf(f, "%zu", &op->size) != 1)
+                break;
+        }
+        if (op->id < 0 || op->id >= t->num_ids)
+            break;
+    }
+    fclose(f);
+    if (i != t->num_ops) {
+        fprintf(stderr, "%s: bad op %d\n", path, i);
+        free(t->ops);
+        return -1;
+    }
+    return 0;
+}
+
+/**********************************************************
+ * replay_trace
+ * Run t once on a fresh heap, adding the time of every op
+ * to hist and returning the peak utilization. If secs is
+ * not NULL, it gets the time the whole replay took
+ **********************************************************/
+static double replay_trace(const trace_t *t, hist_t hist[OP_KINDS], double *secs)
+{
+    void **ptrs = calloc(t->num_ids ? t->num_ids : 1, sizeof(void *));
+    size_t *sizes = calloc(t->num_ids ? t->num_ids : 1, sizeof(size_t));
+    size_t live = 0, peak_live = 0, peak_heap = 0;
+    uint64_t start, end;
+    struct timespec t0, t1;
+
+    mem_reset_brk();
+    if (mm_init_options(&heap_options) < 0) {
+        fprintf(stderr, "%s: mm_init failed\n", t->name);
+        exit(1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int i = 0; i < t->num_ops; ++i) {
+        const op_t *op = &t->ops[i];
+        void *p;
+        switch (op->type) {
+        case OP_ALLOC:
+            start = now();
+            p = mm_malloc(op->size);
+            end = now();
+            break;
+        case OP_REALLOC:
+            start = now();
+            p = mm_realloc(ptrs[op->id], op->size);
+            end = now();
+            break;
+        default:
+            start = now();
+            mm_free(ptrs[op->id]);
+            end = now();
+            p = NULL;
+            break;
+        }
+        hist_add(&hist[op->type], end - start);
+        if (op->type != OP_FREE && p == NULL && op->size != 0) {
+            fprintf(stderr, "%s: op %d: out of memory\n", t->name, i);
+            exit(1);
+        }
+        live += (op->type == OP_FREE ? 0 : op->size) - sizes[op->id];
+        ptrs[op->id] = p;
+        sizes[op->id] = op->type == OP_FREE ? 0 : op->size;
+        if (live > peak_live)
+            peak_live = live;
+        if (mem_heapsize() > peak_heap)
+            peak_heap = mem_heapsize();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    if (secs != NULL)
+        *secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    free(ptrs);
+    free(sizes);
+    return peak_heap ? (double)peak_live / peak_heap : 0;
+}
+
+/*************************************************************************
+ * Multithreaded replay
+ * A handoff queue is a ring that one producer and one consumer share;
+ * a NULL entry tells the consumer that the producer is done.
+*************************************************************************/
+enum { MODE_SINGLE, MODE_COPIES, MODE_SHARDS, MODE_HANDOFF };
+
+static const char *kModeNames[] = { "single", "copies", "shards", "handoff" };
+
+#define QUEUE_SIZE      1024
+
+typedef struct {
+    void *slots[QUEUE_SIZE];
+    unsigned long head;         /* next slot to read, by the consumer */
+    unsigned long tail;         /* next slot to write, by the producer */
+} queue_t;
+
+typedef struct {
+    const trace_t *trace;
+    int mode;
+    int index;
+    int nthreads;
+    queue_t *queue;             /* handoff mode only */
+    pthread_barrier_t *start;
+    int failed;                 /* ran out of memory */
+} worker_t;
+
+/**********************************************************
+ * fill_block / check_block
+ * Write the pattern of id on worker w to the first size
+ * bytes of p, and abort unless they all hold byte c: the
+ * pattern, or 0 for a block from mm_calloc
+ **********************************************************/
+static unsigned char pattern(const worker_t *w, int id)
+{
+    return (unsigned char)(id * 31 + w->index * 7 + 1);
+}
+
+static void fill_block(const worker_t *w, int id, void *p, size_t size)
+{
+    memset(p, pattern(w, id), size);
+}
+
+static void check_block(const worker_t *w, int id, const void *p, size_t size,
+                        unsigned char c)
+{
+    const unsigned char *b = p;
+    for (size_t i = 0; i < size; ++i) {
+        if (b[i] != c) {
+            fprintf(stderr, "%s: thread %d: block %d at %p: byte %zu of %zu "
+                    "is %#x, not %#x\n", w->trace->name, w->index, id, p, i,
+                    size, b[i], c);
+            exit(1);
+        }
+    }
+}
+
+static void queue_put(queue_t *q, void *p)
+{
+    unsigned long tail = q->tail;
+    while (tail - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) == QUEUE_SIZE)
+        sched_yield();
+    q->slots[tail % QUEUE_SIZE] = p;
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static void *queue_get(queue_t *q)
+{
+    unsigned long head = q->head;
+    while (__atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) == head)
+        sched_yield();
+    void *p = q->slots[head % QUEUE_SIZE];
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+    return p;
+}
+
+/**********************************************************
+ * worker_main
+ * Replay the part of the trace that the mode gives to this
+ * thread. The blocks left live at the end are freed
+ **********************************************************/
+static void *worker_main(void *arg)
+{
+    worker_t *w = arg;
+    const trace_t *t = w->trace;
+    void **ptrs = calloc(t->num_ids ? t->num_ids : 1, sizeof(void *));
+    size_t *sizes = calloc(t->num_ids ? t->num_ids : 1, sizeof(size_t));
+
+    pthread_barrier_wait(w->start);
+    if (w->mode == MODE_HANDOFF && w->index % 2 == 1) {
+        void *p;
+        while ((p = queue_get(w->queue)) != NULL)
+            mm_free(p);
+        free(ptrs);
+        free(sizes);
+        return NULL;
+    }
+    for (int i = 0; i < t->num_ops; ++i) {
+        const op_t *op = &t->ops[i];
+        if (w->mode == MODE_SHARDS && op->id % w->nthreads != w->index)
+            continue;
+        if (verify && ptrs[op->id] != NULL)
+            check_block(w, op->id, ptrs[op->id], sizes[op->id], pattern(w, op->id));
+        if (op->type == OP_FREE) {
+            if (w->mode == MODE_HANDOFF && ptrs[op->id] != NULL)
+                queue_put(w->queue, ptrs[op->id]);
+            else
+                mm_free(ptrs[op->id]);
+            ptrs[op->id] = NULL;
+            continue;
+        }
+        void *p;
+        if (op->type == OP_REALLOC)
+            p = mm_realloc(ptrs[op->id], op->size);
+        else if (verify)
+            p = mm_calloc(1, op->size);
+        else
+            p = mm_malloc(op->size);
+        if (p == NULL && op->size != 0) {
+            w->failed = 1;
+            break;
+        }
+        if (verify && p != NULL) {
+            /* A realloc keeps the old contents up to the smaller size */
+            if (op->type == OP_ALLOC)
+                check_block(w, op->id, p, op->size, 0);
+            else if (ptrs[op->id] != NULL)
+                check_block(w, op->id, p, sizes[op->id] < op->size ?
+                            sizes[op->id] : op->size, pattern(w, op->id));
+            fill_block(w, op->id, p, op->size);
+        }
+        ptrs[op->id] = p;
+        sizes[op->id] = op->size;
+    }
+    for (int id = 0; id < t->num_ids; ++id) {
+        if (verify && ptrs[id] != NULL)
+            check_block(w, id, ptrs[id], sizes[id], pattern(w, id));
+        mm_free(ptrs[id]);
+    }
+    if (w->mode == MODE_HANDOFF)
+        queue_put(w->queue, NULL);
+    free(ptrs);
+    free(sizes);
+    return NULL;
+}
+
+/**********************************************************
+ * replay_threads
+ * Run t on nthreads threads in the given mode on a fresh
+ * heap. Returns the throughput in Kops/s, or -1 if the heap
+ * ran out of memory
+ **********************************************************/
+static double replay_threads(const trace_t *t, int mode, int nthreads)
+{
+    pthread_t *threads = calloc(nthreads, sizeof(pthread_t));
+    worker_t *workers = calloc(nthreads, sizeof(worker_t));
+    queue_t *queues = calloc(nthreads / 2 + 1, sizeof(queue_t));
+    pthread_barrier_t start;
+    struct timespec t0, t1;
+    long ops;
+    int failed = 0;
+
+    mem_reset_brk();
+    if (mm_init_options(&heap_options) < 0) {
+        fprintf(stderr, "%s: mm_init failed\n", t->name);
+        exit(1);
+    }
+    pthread_barrier_init(&start, NULL, nthreads + 1);
+    for (int i = 0; i < nthreads; ++i) {
+        workers[i] = (worker_t){ t, mode, i, nthreads, &queues[i / 2], &start, 0 };
+        pthread_create(&threads[i], NULL, worker_main, &workers[i]);
+    }
+    /* The clock starts before the release: a worker may well finish
+       before this thread runs again */
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    pthread_barrier_wait(&start);
+    for (int i = 0; i < nthreads; ++i) {
+        pthread_join(threads[i], NULL);
+        failed |= workers[i].failed;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    if (verify && !mm_check()) {
+        fprintf(stderr, "%s: heap inconsistent after %d threads (%s)\n",
+                t->name, nthreads, kModeNames[mode]);
+        exit(1);
+    }
+    pthread_barrier_destroy(&start);
+    free(threads);
+    free(workers);
+    free(queues);
+    if (failed)
+        return -1;
+
+    if (mode == MODE_SHARDS)
+        ops = t->num_ops;
+    else if (mode == MODE_HANDOFF)
+        ops = (long)t->num_ops * (nthreads / 2);
+    else
+        ops = (long)t->num_ops * nthreads;
+    double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    return secs > 0 ? ops / secs / 1000 : 0;
+}
+
+/**********************************************************
+ * print_scaling
+ * Best throughput of runs replays of t for every thread
+ * count of the curve, and its speedup over the first
+ **********************************************************/
+static void print_scaling(const trace_t *t, int mode, int max_threads, int runs)
+{
+    int step = mode == MODE_HANDOFF ? 2 : 1;
+    double base = 0;
+
+    printf("%s (%s)\n%8s %12s %8s\n", t->name, kModeNames[mode], "threads",
+           "Kops/s", "speedup");
+    max_threads -= max_threads % step;
+    /* Untimed: the largest replay faults the heap in */
+    replay_threads(t, mode, max_threads);
+    for (int n = step; ; n = n * 2 < max_threads ? n * 2 : max_threads) {
+        double best = 0;
+        for (int r = 0; r < runs && best >= 0; ++r) {
+            double kops = replay_threads(t, mode, n);
+            best = kops < 0 ? kops : (kops > best ? kops : best);
+        }
+        if (best < 0) {
+            printf("%8d %12s\n", n, "out of memory");
+            break;
+        }
+        if (base == 0)
+            base = best;
+        printf("%8d %12.0f %8.2f\n", n, best, best / base);
+        if (n == max_threads)
+            break;
+    }
+}
+
+/**********************************************************
+ * print_policies
+ * Peak utilization and best throughput of runs replays of
+ * t under every fit policy of policies, a bitmask, adding
+ * them to the totals of each policy
+ **********************************************************/
+static void print_policies(const trace_t *t, unsigned policies, int runs,
+                           double util_sum[], double kops_sum[])
+{
+    hist_t *hist = calloc(OP_KINDS, sizeof(hist_t));
+    int first = 1;
+
+    for (int f = 0; f < FIT_POLICIES; ++f) {
+        double util = 0, best = 0, secs;
+        if (!(policies & (1u << f)))
+            continue;
+        heap_options.fit_policy = f;
+        for (int r = 0; r < runs; ++r) {
+            util = replay_trace(t, hist, &secs);
+            if (secs > 0 && t->num_ops / secs / 1000 > best)
+                best = t->num_ops / secs / 1000;
+        }
+        printf("%-20s %-8s %4.0f%% %12.0f\n", first ? t->name : "",
+               kFitNames[f], util * 100, best);
+        util_sum[f] += util;
+        kops_sum[f] += best;
+        first = 0;
+    }
+    free(hist);
+}
+
+/**********************************************************
+ * print_row
+ * One line of the report: utilization, then count and
+ * percentiles for every kind of op
+ **********************************************************/
+static void print_row(const char *name, double util, const hist_t hist[OP_KINDS])
+{
+    for (int k = 0; k < OP_KINDS; ++k) {
+        const hist_t *h = &hist[k];
+        if (k == 0)
+            printf("%-20s %4.0f%%  ", name, util * 100);
+        else
+            printf("%-20s        ", "");
+        if (h->count == 0) {
+            printf("%-8s %9d\n", kOpNames[k], 0);
+            continue;
+        }
+        printf("%-8s %9lu %8lu %8lu %8lu %10lu\n", kOpNames[k],
+               (unsigned long)h->count,
+               (unsigned long)hist_percentile(h, 0.5),
+               (unsigned long)hist_percentile(h, 0.99),
+               (unsigned long)hist_percentile(h, 0.999),
+               (unsigned long)h->max);
+    }
+}
+
+/**********************************************************
+ * trace_paths
+ * The .rep files of dir, sorted by name
+ **********************************************************/
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static char **trace_paths(const char *dir, int *n)
+{
+    DIR *d = opendir(dir);
+    struct dirent *e;
+    char **paths = NULL;
+    *n = 0;
+    if (d == NULL) {
+        perror(dir);
+        return NULL;
+    }
+    while ((e = readdir(d)) != NULL) {
+        size_t len = strlen(e->d_name);
+        if (len < 4 || strcmp(e->d_name + len - 4, ".rep") != 0)
+            continue;
+        paths = realloc(paths, (*n + 1) * sizeof(char *));
+        paths[*n] = malloc(strlen(dir) + len + 2);
+        sprintf(paths[*n], "%s/%s", dir, e->d_name);
+        ++*n;
+    }
+    closedir(d);
+    qsort(paths, *n, sizeof(char *), compare_names);
+    return paths;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-hc] [-m <mode>] [-T <threads>] [-n <runs>] [-p <policy>]\n"
+            "          [-k <tries>] [-M <bytes>] [-t <tracedir>] [trace.rep ...]\n"
+            "  -m <mode>      single (default): latency histograms on one thread;\n"
+            "                 copies, shards or handoff: throughput on 1, 2, 4, ...\n"
+            "                 threads\n"
+            "  -T <threads>   most threads for the modes above (default: CPUs)\n"
+            "  -c             check the blocks and the heap in the modes above; the\n"
+            "                 throughput then includes the checks\n"
+            "  -n <runs>      replay every trace this many times (default 1); the\n"
+            "                 thread modes report the best run\n"
+            "  -p <policy>    fit policy: head, first, best-k, best, or all of them\n"
+            "                 in turn (default: the build's); on one thread, report\n"
+            "                 utilization and throughput per policy instead\n"
+            "  -k <tries>     blocks the best-k policy looks at (default: the build's)\n"
+            "  -M <bytes>     requests of at least this size get a mapping of their\n"
+            "                 own (default: the build's)\n"
+            "  -t <tracedir>  replay the .rep files of this directory\n"
+            "                 (default " DEFAULT_TRACEDIR ")\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    const char *tracedir = DEFAULT_TRACEDIR;
+    int runs = 1, ntraces, c, i;
+    int mode = MODE_SINGLE;
+    int max_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    char **paths;
+    hist_t *total = calloc(OP_KINDS, sizeof(hist_t));
+    hist_t *hist = calloc(OP_KINDS, sizeof(hist_t));
+    double util_sum = 0;
+    int util_count = 0;
+    unsigned policies = 0;
+    double policy_util[FIT_POLICIES] = { 0 }, policy_kops[FIT_POLICIES] = { 0 };
+
+    mm_default_options(&heap_options);
+    while ((c = getopt(argc, argv, "hcm:T:n:p:k:M:t:")) != -1) {
+        switch (c) {
+        case 'p':
+            if (strcmp(optarg, "all") == 0) {
+                policies = (1u << FIT_POLICIES) - 1;
+                break;
+            }
+            for (i = 0; i < FIT_POLICIES && strcmp(optarg, kFitNames[i]) != 0; ++i)
+                ;
+            if (i == FIT_POLICIES) {
+                usage(argv[0]);
+                return 1;
+            }
+            policies = 1u << i;
+            break;
+        case 'c':
+            verify = 1;
+            break;
+        case 'k':
+            heap_options.fit_tries = strtoul(optarg, NULL, 10);
+            break;
+        case 'M':
+            heap_options.mmap_threshold = strtoul(optarg, NULL, 10);
+            break;
+        case 'm':
+            for (mode = 0; mode < 4 && strcmp(optarg, kModeNames[mode]) != 0; ++mode)
+                ;
+            if (mode == 4) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'T':
+            max_threads = atoi(optarg);
+            break;
+        case 'n':
+            runs = atoi(optarg);
+            break;
+        case 't':
+            tracedir = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return c == 'h' ? 0 : 1;
+        }
+    }
+    if (optind < argc) {
+        paths = argv + optind;
+        ntraces = argc - optind;
+    } else if ((paths = trace_paths(tracedir, &ntraces)) == NULL) {
+        return 1;
+    }
+
+    mem_init();
+    if (mode != MODE_SINGLE) {
+        if (max_threads < (mode == MODE_HANDOFF ? 2 : 1))
+            max_threads = mode == MODE_HANDOFF ? 2 : 1;
+        for (int i = 0; i < ntraces; ++i) {
+            trace_t t;
+            if (read_trace(paths[i], &t) != 0)
+                return 1;
+            for (int f = 0; f < FIT_POLICIES; ++f) {
+                if (policies == 0 || (policies & (1u << f))) {
+                    if (policies != 0) {
+                        heap_options.fit_policy = f;
+                        printf("policy %s: ", kFitNames[f]);
+                    }
+                    print_scaling(&t, mode, max_threads, runs);
+                }
+                if (policies == 0)
+                    break;
+            }
+            free(t.ops);
+        }
+        return 0;
+    }
+    if (policies != 0) {
+        printf("%-20s %-8s %5s %12s\n", "trace", "policy", "util", "Kops/s");
+        for (i = 0; i < ntraces; ++i) {
+            trace_t t;
+            if (read_trace(paths[i], &t) != 0)
+                return 1;
+            print_policies(&t, policies, runs, policy_util, policy_kops);
+            free(t.ops);
+        }
+        for (int f = 0, first = 1; f < FIT_POLICIES; ++f) {
+            if (!(policies & (1u << f)))
+                continue;
+            printf("%-20s %-8s %4.0f%% %12.0f\n", first ? "Total" : "",
+                   kFitNames[f], ntraces ? policy_util[f] / ntraces * 100 : 0,
+                   ntraces ? policy_kops[f] / ntraces : 0);
+            first = 0;
+        }
+        return 0;
+    }
+    printf("%-20s %5s  %-8s %9s %8s %8s %8s %10s\n", "trace", "util", "op",
+           "count", "p50", "p99", "p99.9", "max");
+    for (int i = 0; i < ntraces; ++i) {
+        trace_t t;
+        double util = 0;
+        if (read_trace(paths[i], &t) != 0)
+            return 1;
+        memset(hist, 0, OP_KINDS * sizeof(hist_t));
+        for (int r = 0; r < runs; ++r)
+            util = replay_trace(&t, hist, NULL);
+        print_row(t.name, util, hist);
+        for (int k = 0; k < OP_KINDS; ++k)
+            hist_merge(&total[k], &hist[k]);
+        util_sum += util;
+        util_count++;
+        free(t.ops);
+    }
+    print_row("Total", util_count ? util_sum / util_count : 0, total);
+#if defined(__x86_64__) || defined(__i386__)
+    printf("Times are in cycles (rdtsc)\n");
+#else
+    printf("Times are in nanoseconds\n");
+#endif
+    return 0;
+}
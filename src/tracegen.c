@@ -0,0 +1,358 @@
+/*
+ * tracegen: writes synthetic traces in the .rep format of mdriver and
+ * replay.
+ *
+ * Every allocation gets an id of its own. A block is freed according to
+ * the lifetime model, and live blocks are reallocated now and then to grow
+ * them; once the requested number of ops is near, the blocks still live
+ * are freed, so the trace is balanced. The header carries the peak live
+ * payload as the suggested heap size.
+ *
+ * Size distributions (-s):
+ *     fixed:<size>
+ *     uniform:<min>,<max>
+ *     lognormal:<median>,<sigma>     sigma of the log of the size
+ *     hist:<file>                    lines of "<size> <weight>"
+ * Lifetime models (-l):
+ *     random       free a random live block
+ *     fifo         free the oldest live block
+ *     lifo         free the youngest live block
+ *     exp:<mean>   every block lives an exponentially distributed number
+ *                  of ops with the given mean
+ * Under the first three, a step frees with probability -f (0.5 by
+ * default). Under every model the working set is capped at -w blocks.
+ *
+ * mdriver compares the data of a reallocated block as signed chars with
+ * the low byte of its id, which fails for low bytes of 128 and up. Traces
+ * with reallocations therefore skip those ids.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <math.h>
+
+enum { LIFE_RANDOM, LIFE_FIFO, LIFE_LIFO, LIFE_EXP };
+
+typedef struct {
+    char type;
+    int id;
+    size_t size;
+} op_t;
+
+/* A live block on the lifetime heap; the smallest key is freed first */
+typedef struct {
+    double key;
+    int id;
+} entry_t;
+
+static uint64_t rng_state = 88172645463325252ull;
+
+/**********************************************************
+ * rand_u64 / rand_unit / rand_normal
+ * xorshift64* generator, uniform in [0, 1), and standard
+ * normal (Box-Muller)
+ **********************************************************/
+static uint64_t rand_u64(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ull;
+}
+
+static double rand_unit(void)
+{
+    return (rand_u64() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double rand_normal(void)
+{
+    double u = 1 - rand_unit(), v = rand_unit();
+    return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+/*************************************************************************
+ * Size distributions
+*************************************************************************/
+enum { SIZE_FIXED, SIZE_UNIFORM, SIZE_LOGNORMAL, SIZE_HIST };
+
+static int size_kind;
+static double size_a, size_b;
+static size_t *hist_sizes;
+static double *hist_cumulative;
+static int hist_len;
+
+/**********************************************************
+ * parse_sizes
+ * Set up the distribution named by spec. Returns 0 on
+ * success
+ **********************************************************/
+static int parse_sizes(const char *spec)
+{
+    if (sscanf(spec, "fixed:%lf", &size_a) == 1) {
+        size_kind = SIZE_FIXED;
+    } else if (sscanf(spec, "uniform:%lf,%lf", &size_a, &size_b) == 2) {
+        size_kind = SIZE_UNIFORM;
+    } else if (sscanf(spec, "lognormal:%lf,%lf", &size_a, &size_b) == 2) {
+        size_kind = SIZE_LOGNORMAL;
+    } else if (strncmp(spec, "hist:", 5) == 0) {
+        FILE *f = fopen(spec + 5, "r");
+        double size, weight, total = 0;
+        if (f == NULL) {
+            perror(spec + 5);
+            return -1;
+        }
+        while (fscanf(f, "%lf %lf", &size, &weight) == 2) {
+            hist_sizes = realloc(hist_sizes, (hist_len + 1) * sizeof(size_t));
+            hist_cumulative = realloc(hist_cumulative, (hist_len + 1) * sizeof(double));
+            total += weight;
+            hist_sizes[hist_len] = (size_t)size;
+            hist_cumulative[hist_len++] = total;
+        }
+        fclose(f);
+        if (hist_len == 0 || total <= 0) {
+            fprintf(stderr, "%s: no sizes\n", spec + 5);
+            return -1;
+        }
+        size_kind = SIZE_HIST;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+/**********************************************************
+ * draw_size
+ * A request size of at least 1 byte from the distribution
+ **********************************************************/
+static size_t draw_size(void)
+{
+    double s;
+    switch (size_kind) {
+    case SIZE_FIXED:
+        s = size_a;
+        break;
+    case SIZE_UNIFORM:
+        s = size_a + rand_unit() * (size_b - size_a + 1);
+        break;
+    case SIZE_LOGNORMAL:
+        s = exp(log(size_a) + size_b * rand_normal());
+        break;
+    default: {
+        double r = rand_unit() * hist_cumulative[hist_len - 1];
+        int lo = 0, hi = hist_len - 1;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (hist_cumulative[mid] > r)
+                hi = mid;
+            else
+                lo = mid + 1;
+        }
+        s = hist_sizes[lo];
+        break;
+    }
+    }
+    return s < 1 ? 1 : (size_t)s;
+}
+
+/*************************************************************************
+ * Lifetime heap
+ * A binary min-heap of the live blocks, keyed by time of death (exp),
+ * birth (fifo) or minus birth (lifo)
+*************************************************************************/
+static entry_t *heap;
+static int heap_len;
+
+static void heap_push(double key, int id)
+{
+    int i = heap_len++;
+    heap = realloc(heap, heap_len * sizeof(entry_t));
+    for (; i > 0 && heap[(i - 1) / 2].key > key; i = (i - 1) / 2)
+        heap[i] = heap[(i - 1) / 2];
+    heap[i] = (entry_t){ key, id };
+}
+
+static int heap_pop(void)
+{
+    int id = heap[0].id;
+    entry_t last = heap[--heap_len];
+    int i = 0;
+    for (;;) {
+        int c = 2 * i + 1;
+        if (c >= heap_len)
+            break;
+        if (c + 1 < heap_len && heap[c + 1].key < heap[c].key)
+            c++;
+        if (heap[c].key >= last.key)
+            break;
+        heap[i] = heap[c];
+        i = c;
+    }
+    if (heap_len > 0)
+        heap[i] = last;
+    return id;
+}
+
+/**********************************************************
+ * trace_id
+ * The id written for the k-th block: k itself, or k with
+ * the ids whose low byte is 128 or more left out
+ **********************************************************/
+static long trace_id(long k, int skip_high_bytes)
+{
+    return skip_high_bytes ? k / 128 * 256 + k % 128 : k;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-h] [-n <ops>] [-s <sizes>] [-l <lifetime>] [-f <p>]\n"
+            "          [-w <blocks>] [-r <p>,<factor>] [-S <seed>] [-o <file>]\n"
+            "  -n <ops>          about this many ops (default 100000)\n"
+            "  -s <sizes>        fixed:<size>, uniform:<min>,<max>,\n"
+            "                    lognormal:<median>,<sigma> or hist:<file>\n"
+            "                    (default lognormal:64,1)\n"
+            "  -l <lifetime>     random, fifo, lifo or exp:<mean ops> (default random)\n"
+            "  -f <p>            chance that a step frees, but for exp (default 0.5)\n"
+            "  -w <blocks>       most live blocks (default 1000)\n"
+            "  -r <p>,<factor>   chance that a step grows a live block by factor\n"
+            "                    with realloc (default 0)\n"
+            "  -S <seed>         random seed\n"
+            "  -o <file>         write the trace to file instead of stdout\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    long num_ops = 100000;
+    int life = LIFE_RANDOM;
+    double life_mean = 0, free_prob = 0.5, realloc_prob = 0, realloc_factor = 1;
+    int max_live = 1000, c;
+    FILE *out = stdout;
+
+    parse_sizes("lognormal:64,1");
+    while ((c = getopt(argc, argv, "hn:s:l:f:w:r:S:o:")) != -1) {
+        switch (c) {
+        case 'n':
+            num_ops = atol(optarg);
+            break;
+        case 's':
+            if (parse_sizes(optarg) != 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'l':
+            if (strcmp(optarg, "random") == 0)
+                life = LIFE_RANDOM;
+            else if (strcmp(optarg, "fifo") == 0)
+                life = LIFE_FIFO;
+            else if (strcmp(optarg, "lifo") == 0)
+                life = LIFE_LIFO;
+            else if (sscanf(optarg, "exp:%lf", &life_mean) == 1 && life_mean > 0)
+                life = LIFE_EXP;
+            else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'f':
+            free_prob = atof(optarg);
+            break;
+        case 'w':
+            max_live = atoi(optarg);
+            break;
+        case 'r':
+            if (sscanf(optarg, "%lf,%lf", &realloc_prob, &realloc_factor) != 2) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'S':
+            rng_state = strtoull(optarg, NULL, 0) * 0x9E3779B97F4A7C15ull + 1;
+            break;
+        case 'o':
+            if ((out = fopen(optarg, "w")) == NULL) {
+                perror(optarg);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return c == 'h' ? 0 : 1;
+        }
+    }
+    if (max_live < 1)
+        max_live = 1;
+
+    op_t *ops = malloc((num_ops + 1) * sizeof(op_t));
+    int *live = malloc(max_live * sizeof(int));     /* the live ids */
+    int *pos = NULL;                                /* index in live, by id */
+    size_t *sizes = NULL;                           /* by id */
+    int num_live = 0, num_ids = 0;
+    long n = 0;
+    size_t live_bytes = 0, peak_bytes = 0;
+
+    /* Leave room to free what is still live at the end */
+    while (n + num_live < num_ops) {
+        int id;
+        int must_free = num_live == max_live || n + num_live + 1 >= num_ops;
+        if (num_live > 0 && (must_free ||
+                (life == LIFE_EXP ? heap[0].key <= n : rand_unit() < free_prob))) {
+            if (life == LIFE_RANDOM)
+                id = live[rand_u64() % num_live];
+            else
+                id = heap_pop();
+            /* Unlink id from the live ids; the lifetime heap no longer
+               holds it */
+            live[pos[id]] = live[--num_live];
+            pos[live[pos[id]]] = pos[id];
+            live_bytes -= sizes[id];
+            ops[n++] = (op_t){ 'f', id, 0 };
+            continue;
+        }
+        if (num_live > 0 && rand_unit() < realloc_prob) {
+            id = live[rand_u64() % num_live];
+            size_t size = (size_t)(sizes[id] * realloc_factor);
+            if (size <= sizes[id])
+                size = sizes[id] + 1;
+            live_bytes += size - sizes[id];
+            sizes[id] = size;
+            ops[n++] = (op_t){ 'r', id, size };
+        } else {
+            id = num_ids++;
+            pos = realloc(pos, num_ids * sizeof(int));
+            sizes = realloc(sizes, num_ids * sizeof(size_t));
+            sizes[id] = draw_size();
+            pos[id] = num_live;
+            live[num_live++] = id;
+            live_bytes += sizes[id];
+            if (life == LIFE_EXP)
+                heap_push(n - life_mean * log(1 - rand_unit()), id);
+            else if (life != LIFE_RANDOM)
+                heap_push(life == LIFE_FIFO ? n : -n, id);
+            ops[n++] = (op_t){ 'a', id, sizes[id] };
+        }
+        if (live_bytes > peak_bytes)
+            peak_bytes = live_bytes;
+    }
+    while (num_live > 0)
+        ops[n++] = (op_t){ 'f', live[--num_live], 0 };
+
+    int skip = realloc_prob > 0;
+    fprintf(out, "%zu\n%ld\n%ld\n1\n", peak_bytes,
+            num_ids ? trace_id(num_ids - 1, skip) + 1 : 0, n);
+    for (long i = 0; i < n; ++i) {
+        long id = trace_id(ops[i].id, skip);
+        if (ops[i].type == 'f')
+            fprintf(out, "f %ld\n", id);
+        else
+            fprintf(out, "%c %ld %zu\n", ops[i].type, id, ops[i].size);
+    }
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}